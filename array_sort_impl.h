@@ -0,0 +1,74 @@
+/*
+ * Stable bottom-up merge sort of an array, specialized to one element
+ * type and order.
+ *
+ * This file has no include guard: queue.c includes it once per array
+ * sort, after defining
+ *   ARRAY_SORT_NAME       name of the function it defines
+ *   ARRAY_SORT_TYPE       type of the array elements
+ *   ARRAY_SORT_CMP(a, b)  comparison of elements a and b, with the
+ *                         result convention of strcmp
+ * and optionally
+ *   ARRAY_SORT_PREFETCH(x)  hint that element x is compared a few steps
+ *                           into a merge from now
+ * so that the comparison is inlined into the sort.  The macros are
+ * undefined at the end.
+ *
+ * The function defined sorts the n elements of a, using tmp, which has
+ * room for as many, and returns whichever of the two ends up sorted.
+ */
+
+#ifndef ARRAY_SORT_RUN
+/* Stretches of elements sorted by insertion before merging starts */
+#define ARRAY_SORT_RUN 16
+
+/* How many steps ahead of a merge ARRAY_SORT_PREFETCH is given elements */
+#define ARRAY_SORT_AHEAD 8
+#endif
+
+static ARRAY_SORT_TYPE *ARRAY_SORT_NAME(ARRAY_SORT_TYPE *a,
+                                        ARRAY_SORT_TYPE *tmp,
+                                        size_t n)
+{
+    for (size_t lo = 0; lo < n; lo += ARRAY_SORT_RUN) {
+        size_t hi = lo + ARRAY_SORT_RUN < n ? lo + ARRAY_SORT_RUN : n;
+        for (size_t i = lo + 1; i < hi; i++) {
+            ARRAY_SORT_TYPE x = a[i];
+            size_t j = i;
+            while (j > lo && ARRAY_SORT_CMP(a[j - 1], x) > 0) {
+                a[j] = a[j - 1];
+                j--;
+            }
+            a[j] = x;
+        }
+    }
+    for (size_t width = ARRAY_SORT_RUN; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo, j = mid, o = lo;
+            while (i < mid && j < hi) {
+#ifdef ARRAY_SORT_PREFETCH
+                if (i + ARRAY_SORT_AHEAD < mid)
+                    ARRAY_SORT_PREFETCH(a[i + ARRAY_SORT_AHEAD]);
+                if (j + ARRAY_SORT_AHEAD < hi)
+                    ARRAY_SORT_PREFETCH(a[j + ARRAY_SORT_AHEAD]);
+#endif
+                tmp[o++] = ARRAY_SORT_CMP(a[j], a[i]) < 0 ? a[j++] : a[i++];
+            }
+            while (i < mid)
+                tmp[o++] = a[i++];
+            while (j < hi)
+                tmp[o++] = a[j++];
+        }
+        ARRAY_SORT_TYPE *swap = a;
+        a = tmp;
+        tmp = swap;
+    }
+    return a;
+}
+
+#undef ARRAY_SORT_NAME
+#undef ARRAY_SORT_TYPE
+#undef ARRAY_SORT_CMP
+#undef ARRAY_SORT_PREFETCH
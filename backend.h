@@ -0,0 +1,152 @@
+#ifndef LAB0_BACKEND_H
+#define LAB0_BACKEND_H
+
+/*
+ * Queue variants that do not keep their elements in a linked list of
+ * list_ele_t supply their own implementation of the queue operations.
+ * queue.c takes care of NULL queues and forwards everything else here.
+ * Backends keep q->size up to date, or report their size through the
+ * size operation, so q_size() stays constant time.
+ *
+ * Thread-safe backends let insert_tail, remove_head and take_head run
+ * from several threads at once, and update q->size atomically.  SPSC
+ * backends allow one thread inserting at the tail and another removing
+ * from the head.  All other operations still need the queue to
+ * themselves.
+ */
+
+#include "queue.h"
+
+/* Size of a cache line, kept between fields that threads write apart */
+#define CACHE_LINE 64
+
+struct BACKEND {
+    bool thread_safe;
+    bool spsc_safe; /* Set for thread-safe backends as well */
+    /* Set up q->impl, return false if could not allocate space */
+    bool (*init)(queue_t *q);
+    /* Free q->impl together with all elements */
+    void (*destroy)(queue_t *q);
+    bool (*insert_head)(queue_t *q, char *s);
+    bool (*insert_tail)(queue_t *q, char *s);
+    bool (*remove_head)(queue_t *q, char *sp, size_t bufsize);
+    /* Detach the head string, the caller frees it.  NULL if empty */
+    char *(*take_head)(queue_t *q);
+    /* Optional: remove_head at the other end, slower without it */
+    bool (*remove_tail)(queue_t *q, char *sp, size_t bufsize);
+    /* Optional: tail string, NULL if empty, else found by a walk */
+    char *(*peek_tail)(queue_t *q);
+    /*
+     * Optional: insert_tail and take_head of bounded queues, waiting for
+     * room or for a string up to timeout_ms, or forever if negative
+     */
+    bool (*insert_tail_wait)(queue_t *q, char *s, int timeout_ms);
+    char *(*take_head_wait)(queue_t *q, int timeout_ms);
+    /* Optional: bulk insertion at the tail, as q_insert_tail_many() */
+    int (*insert_tail_many)(queue_t *q, char **sv, int n, bool repeat);
+    /* Optional: number of strings, for backends not keeping q->size */
+    unsigned int (*size)(queue_t *q);
+    /* Optional: make room for n more strings ahead of a bulk insertion */
+    bool (*reserve)(queue_t *q, int n);
+    /* Move all strings of src to the tail of dst, of the same backend */
+    bool (*concat)(queue_t *dst, queue_t *src);
+    /* Move the first k strings of q, k <= q_size(q), to the tail of out */
+    bool (*split)(queue_t *q, int k, queue_t *out);
+    void (*reverse)(queue_t *q);
+    void (*sort)(queue_t *q, q_cmp_t cmp);
+    void (*iter_init)(queue_t *q, q_iter_t *it);
+    char *(*iter_next)(queue_t *q, q_iter_t *it);
+};
+
+extern const struct BACKEND unrolled_backend;
+extern const struct BACKEND ring_backend;
+extern const struct BACKEND lockfree_backend;
+extern const struct BACKEND twolock_backend;
+extern const struct BACKEND bounded_backend;
+extern const struct BACKEND spsc_backend;
+extern const struct BACKEND combining_backend;
+extern const struct BACKEND deque_backend;
+
+/*
+ * Create empty queue of the given variant, which holds at most capacity
+ * elements if it is Q_BOUNDED or Q_SPSC, for backends built on another
+ * variant.  Unlike q_new_kind(), nothing is reported on success.
+ * Return NULL if could not allocate space.
+ */
+queue_t *queue_create(q_kind_t kind, unsigned int capacity);
+
+/*
+ * Detach the head string of Q_PLAIN queue q as a block of its own, which
+ * the caller frees, without allocating anything: a long string already
+ * has its block, and a short one is moved to the front of its element,
+ * whose block it then takes over.
+ * Return NULL if q is empty.
+ */
+char *queue_take_block(queue_t *q);
+
+/* Tell the processor the thread is spinning on another one */
+static inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Copy string s of length len to sp, as q_remove_head() does: at most
+ * bufsize-1 characters plus a null terminator.  No effect if sp is NULL.
+ */
+void copy_removed(char *sp, size_t bufsize, const char *s, size_t len);
+
+/*
+ * Array backends share these helpers from ring.c: reverse a[from, to),
+ * and sort a[0, n) by cmp without allocating.
+ */
+void slots_reverse(char **a, unsigned int from, unsigned int to);
+void slots_sort(char **a, size_t n, q_cmp_t cmp);
+
+/*
+ * Linked backends keep their strings in a chain of nodes after a sentinel
+ * node, whose own value is unused.  These helpers work on such a chain
+ * while no other thread uses it.
+ */
+typedef struct CNODE {
+    struct CNODE *next;
+    char *value;
+} cnode_t;
+
+/* Node holding a copy of s, NULL if could not allocate space */
+cnode_t *chain_node(const char *s);
+
+/* Free the sentinel, then every node after it with its string */
+void chain_free(cnode_t *sentinel);
+
+/*
+ * Put a copy of s in front of the chain whose sentinel is *head: the
+ * sentinel takes the string, and a new sentinel goes in front of it.
+ * Return false if could not allocate space.
+ */
+bool chain_push(cnode_t **head, const char *s);
+
+/* Node k places after n, which must exist */
+cnode_t *chain_at(cnode_t *n, unsigned int k);
+
+/*
+ * Move the nodes after sentinel from, up to and including last, behind
+ * the last node *to_tail of another chain, updating both tails.
+ */
+void chain_move(cnode_t *from,
+                cnode_t **from_tail,
+                cnode_t *last,
+                cnode_t **to_tail);
+
+/* Walk a chain from the node stored in it->node */
+char *chain_iter_next(q_iter_t *it);
+
+/* Reverse the nodes after the sentinel, return the new last node */
+cnode_t *chain_reverse(cnode_t *sentinel);
+
+/* Sort the nodes after the sentinel by cmp, return the new last node */
+cnode_t *chain_sort(cnode_t *sentinel, q_cmp_t cmp);
+
+#endif /* LAB0_BACKEND_H */
@@ -0,0 +1,270 @@
+/*
+ * Bounded blocking backend for Q_BOUNDED queues.
+ *
+ * A chain of nodes behind a sentinel, guarded by a single lock, holding
+ * at most q->capacity strings.  Insertion into a full queue and removal
+ * from an empty one fail at once, while their _wait variants block
+ * until the other side makes room or brings a string, which gives
+ * producers backpressure instead of an ever growing queue.
+ *
+ * Waiting first spins for a while on the size, which is kept atomically,
+ * since under contention the queue rarely stays full or empty for long.
+ * Only then does the thread park on a condition variable, which the
+ * other side signals when it knows somebody is parked there.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "backend.h"
+#include "harness.h"
+
+/* Polls of the size before parking */
+#define BOUNDED_SPIN 100
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+    unsigned int producers_parked;
+    unsigned int consumers_parked;
+    cnode_t *head; /* Sentinel */
+    cnode_t *tail; /* Last node */
+} bqueue_t;
+
+static inline unsigned int bq_size(queue_t *q)
+{
+    return __atomic_load_n(&q->size, __ATOMIC_RELAXED);
+}
+
+static bool bq_init(queue_t *q)
+{
+    bqueue_t *b = malloc(sizeof(bqueue_t));
+    if (b == NULL)
+        return false;
+    b->head = malloc(sizeof(cnode_t));
+    if (b->head == NULL) {
+        free(b);
+        return false;
+    }
+    b->head->next = NULL;
+    b->head->value = NULL;
+    b->tail = b->head;
+    b->producers_parked = 0;
+    b->consumers_parked = 0;
+
+    /* Deadlines of timed waits are on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&b->not_full, &attr);
+    pthread_cond_init(&b->not_empty, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&b->lock, NULL);
+    q->impl = b;
+    return true;
+}
+
+static void bq_destroy(queue_t *q)
+{
+    bqueue_t *b = q->impl;
+    chain_free(b->head);
+    pthread_cond_destroy(&b->not_full);
+    pthread_cond_destroy(&b->not_empty);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
+
+/* Deadline timeout_ms milliseconds from now */
+static void bq_deadline(struct timespec *ts, int timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Park on cv, with the lock held, until signalled or past the deadline,
+ * which is none if NULL.  Return false once the deadline has passed.
+ */
+static bool bq_park(bqueue_t *b,
+                    pthread_cond_t *cv,
+                    unsigned int *parked,
+                    const struct timespec *deadline)
+{
+    *parked += 1;
+    int err = deadline == NULL ? pthread_cond_wait(cv, &b->lock)
+                               : pthread_cond_timedwait(cv, &b->lock, deadline);
+    *parked -= 1;
+    return err != ETIMEDOUT;
+}
+
+/*
+ * The node is only allocated once there is room for it, under the lock,
+ * so that a wait that fails has nothing to free.
+ */
+static bool bq_insert_tail_wait(queue_t *q, char *s, int timeout_ms)
+{
+    bqueue_t *b = q->impl;
+    struct timespec deadline;
+    if (timeout_ms > 0)
+        bq_deadline(&deadline, timeout_ms);
+    for (unsigned int i = 0;
+         i < BOUNDED_SPIN && timeout_ms != 0 && bq_size(q) >= q->capacity; i++)
+        cpu_relax();
+
+    pthread_mutex_lock(&b->lock);
+    while (q->size >= q->capacity && timeout_ms != 0 &&
+           bq_park(b, &b->not_full, &b->producers_parked,
+                   timeout_ms > 0 ? &deadline : NULL))
+        ;
+    cnode_t *n = q->size < q->capacity ? chain_node(s) : NULL;
+    if (n == NULL) {
+        pthread_mutex_unlock(&b->lock);
+        return false;
+    }
+    b->tail->next = n;
+    b->tail = n;
+    __atomic_fetch_add(&q->size, 1, __ATOMIC_RELAXED);
+    bool wake = b->consumers_parked > 0;
+    pthread_mutex_unlock(&b->lock);
+    if (wake)
+        pthread_cond_signal(&b->not_empty);
+    return true;
+}
+
+static char *bq_take_head_wait(queue_t *q, int timeout_ms)
+{
+    bqueue_t *b = q->impl;
+    struct timespec deadline;
+    if (timeout_ms > 0)
+        bq_deadline(&deadline, timeout_ms);
+    for (unsigned int i = 0;
+         i < BOUNDED_SPIN && timeout_ms != 0 && bq_size(q) == 0; i++)
+        cpu_relax();
+
+    pthread_mutex_lock(&b->lock);
+    while (q->size == 0 && timeout_ms != 0 &&
+           bq_park(b, &b->not_empty, &b->consumers_parked,
+                   timeout_ms > 0 ? &deadline : NULL))
+        ;
+    if (q->size == 0) {
+        pthread_mutex_unlock(&b->lock);
+        return NULL;
+    }
+    /* The first node becomes the sentinel, its string is ours */
+    cnode_t *head = b->head;
+    char *s = head->next->value;
+    b->head = head->next;
+    __atomic_fetch_sub(&q->size, 1, __ATOMIC_RELAXED);
+    bool wake = b->producers_parked > 0;
+    pthread_mutex_unlock(&b->lock);
+    if (wake)
+        pthread_cond_signal(&b->not_full);
+    free(head);
+    return s;
+}
+
+static bool bq_insert_tail(queue_t *q, char *s)
+{
+    return bq_insert_tail_wait(q, s, 0);
+}
+
+static char *bq_take_head(queue_t *q)
+{
+    return bq_take_head_wait(q, 0);
+}
+
+static bool bq_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    char *s = bq_take_head(q);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+/* The remaining operations need the queue to themselves */
+
+static bool bq_insert_head(queue_t *q, char *s)
+{
+    bqueue_t *b = q->impl;
+    if (q->size >= q->capacity || !chain_push(&b->head, s))
+        return false;
+    q->size += 1;
+    return true;
+}
+
+static bool bq_concat(queue_t *dst, queue_t *src)
+{
+    bqueue_t *d = dst->impl, *s = src->impl;
+    if ((size_t) dst->size + src->size > dst->capacity)
+        return false;
+    chain_move(s->head, &s->tail, s->tail, &d->tail);
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+static bool bq_split(queue_t *q, int k, queue_t *out)
+{
+    bqueue_t *b = q->impl, *o = out->impl;
+    if ((size_t) out->size + k > out->capacity)
+        return false;
+    chain_move(b->head, &b->tail, chain_at(b->head, k), &o->tail);
+    q->size -= k;
+    out->size += k;
+    return true;
+}
+
+static void bq_reverse(queue_t *q)
+{
+    bqueue_t *b = q->impl;
+    b->tail = chain_reverse(b->head);
+}
+
+static void bq_sort(queue_t *q, q_cmp_t cmp)
+{
+    bqueue_t *b = q->impl;
+    b->tail = chain_sort(b->head, cmp);
+}
+
+static void bq_iter_init(queue_t *q, q_iter_t *it)
+{
+    bqueue_t *b = q->impl;
+    it->node = b->head->next;
+    it->idx = 0;
+}
+
+static char *bq_iter_next(queue_t *q, q_iter_t *it)
+{
+    return chain_iter_next(it);
+}
+
+const struct BACKEND bounded_backend = {
+    .thread_safe = true,
+    .spsc_safe = true,
+    .init = bq_init,
+    .destroy = bq_destroy,
+    .insert_head = bq_insert_head,
+    .insert_tail = bq_insert_tail,
+    .remove_head = bq_remove_head,
+    .take_head = bq_take_head,
+    .insert_tail_wait = bq_insert_tail_wait,
+    .take_head_wait = bq_take_head_wait,
+    .concat = bq_concat,
+    .split = bq_split,
+    .reverse = bq_reverse,
+    .sort = bq_sort,
+    .iter_init = bq_iter_init,
+    .iter_next = bq_iter_next,
+};
@@ -0,0 +1,142 @@
+/*
+ * Chains of string nodes behind a sentinel, shared by the linked backends
+ * for the operations that run while no other thread uses the queue.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+cnode_t *chain_node(const char *s)
+{
+    cnode_t *n = malloc(sizeof(cnode_t));
+    if (n == NULL)
+        return NULL;
+    n->value = strdup(s);
+    if (n->value == NULL) {
+        free(n);
+        return NULL;
+    }
+    n->next = NULL;
+    return n;
+}
+
+void chain_free(cnode_t *sentinel)
+{
+    cnode_t *n = sentinel->next;
+    free(sentinel);
+    while (n != NULL) {
+        cnode_t *next = n->next;
+        free(n->value);
+        free(n);
+        n = next;
+    }
+}
+
+bool chain_push(cnode_t **head, const char *s)
+{
+    cnode_t *n = chain_node(s);
+    if (n == NULL)
+        return false;
+    (*head)->value = n->value;
+    n->value = NULL;
+    n->next = *head;
+    *head = n;
+    return true;
+}
+
+cnode_t *chain_at(cnode_t *n, unsigned int k)
+{
+    while (k-- > 0)
+        n = n->next;
+    return n;
+}
+
+void chain_move(cnode_t *from,
+                cnode_t **from_tail,
+                cnode_t *last,
+                cnode_t **to_tail)
+{
+    if (last == from)
+        return;
+    (*to_tail)->next = from->next;
+    *to_tail = last;
+    from->next = last->next;
+    if (*from_tail == last)
+        *from_tail = from;
+    last->next = NULL;
+}
+
+char *chain_iter_next(q_iter_t *it)
+{
+    cnode_t *n = it->node;
+    if (n == NULL)
+        return NULL;
+    it->node = n->next;
+    it->idx++;
+    return n->value;
+}
+
+cnode_t *chain_reverse(cnode_t *sentinel)
+{
+    cnode_t *prev = NULL, *cur = sentinel->next;
+    cnode_t *last = cur != NULL ? cur : sentinel;
+    while (cur != NULL) {
+        cnode_t *next = cur->next;
+        cur->next = prev;
+        prev = cur;
+        cur = next;
+    }
+    sentinel->next = prev;
+    return last;
+}
+
+/*
+ * Bottom-up merge sort: each pass merges neighbouring sorted runs of
+ * width nodes, doubling width until a single run is left.  Equal strings
+ * keep their order, and nothing is allocated.
+ */
+cnode_t *chain_sort(cnode_t *sentinel, q_cmp_t cmp)
+{
+    cnode_t *list = sentinel->next, *last = sentinel;
+    if (list == NULL)
+        return sentinel;
+    for (size_t width = 1;; width *= 2) {
+        cnode_t *a = list, *out = NULL, **link = &out;
+        unsigned int merges = 0;
+        while (a != NULL) {
+            cnode_t *b = a;
+            size_t alen = 0, blen = width;
+            while (alen < width && b != NULL) {
+                alen++;
+                b = b->next;
+            }
+            while (alen > 0 || (blen > 0 && b != NULL)) {
+                cnode_t *n;
+                if (alen > 0 &&
+                    (blen == 0 || b == NULL || cmp(a->value, b->value) <= 0)) {
+                    n = a;
+                    a = a->next;
+                    alen--;
+                } else {
+                    n = b;
+                    b = b->next;
+                    blen--;
+                }
+                *link = n;
+                link = &n->next;
+                last = n;
+            }
+            a = b;
+            merges++;
+        }
+        *link = NULL;
+        list = out;
+        if (merges <= 1)
+            break;
+    }
+    sentinel->next = list;
+    return last;
+}
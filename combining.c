@@ -0,0 +1,323 @@
+/*
+ * Flat-combining backend for Q_COMBINING queues.
+ *
+ * A plain queue, which only ever runs one operation at a time, wrapped
+ * so that many threads can share it.  Rather than each taking the lock
+ * in turn, a thread publishes its insertion or removal in a slot of its
+ * own, then waits on that slot, taking the lock whenever it sees it
+ * free.  Whoever gets it becomes the combiner: it applies every request
+ * published so far and hands back results through the slots.  The queue
+ * itself stays in the combiner's cache, and all the insertions of a pass
+ * are chained up in a scratch queue by q_insert_tail_many(), then
+ * spliced at the tail at once.
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+
+#include "backend.h"
+#include "harness.h"
+
+/* Slots for requests, threads beyond that many wait for one to free up */
+#define FC_SLOTS 64
+
+/* Most passes over the slots a combiner makes while it finds requests */
+#define FC_PASSES 4
+
+/* Polls of a slot before yielding the processor */
+#define FC_SPIN 64
+
+/* State of a slot */
+enum {
+    FC_FREE,   /* Nobody uses it */
+    FC_BUSY,   /* Claimed by a thread writing its request */
+    FC_INSERT, /* Requests insertion of s at the tail */
+    FC_REMOVE, /* Requests removal from the head into sp */
+    FC_TAKE,   /* Requests removal from the head into taken */
+    FC_DONE,   /* Carried out, results are in ok and taken */
+};
+
+typedef struct {
+    int state;
+    bool ok;
+    char *s;
+    char *sp;
+    size_t bufsize;
+    char *taken;
+} fc_req_t;
+
+/* Each slot takes a cache line, written by its thread and the combiner */
+typedef struct {
+    fc_req_t req;
+    char pad[CACHE_LINE - sizeof(fc_req_t)];
+} fc_slot_t;
+
+typedef struct {
+    bool lock;      /* Held by the combiner */
+    queue_t *inner; /* Plain queue holding the strings */
+    queue_t *batch; /* Plain queue chaining up the insertions of a pass */
+    char pad[CACHE_LINE];
+    fc_slot_t slot[FC_SLOTS];
+} fcqueue_t;
+
+/* Slot a thread tries first, spreading threads over the slots */
+static __thread unsigned int fc_hint;
+static unsigned int fc_threads;
+
+static bool fc_init(queue_t *q)
+{
+    fcqueue_t *fc = malloc(sizeof(fcqueue_t));
+    if (fc == NULL)
+        return false;
+    fc->inner = queue_create(Q_PLAIN, 0);
+    fc->batch = queue_create(Q_PLAIN, 0);
+    if (fc->inner == NULL || fc->batch == NULL) {
+        q_free(fc->inner);
+        q_free(fc->batch);
+        free(fc);
+        return false;
+    }
+    for (unsigned int i = 0; i < FC_SLOTS; i++)
+        fc->slot[i].req.state = FC_FREE;
+    fc->lock = false;
+    q->impl = fc;
+    return true;
+}
+
+static void fc_destroy(queue_t *q)
+{
+    fcqueue_t *fc = q->impl;
+    q_free(fc->inner);
+    q_free(fc->batch);
+    free(fc);
+}
+
+/* Mirror the size of the inner queue, for q_size() from other threads */
+static inline void fc_sync_size(queue_t *q, fcqueue_t *fc)
+{
+    __atomic_store_n(&q->size, fc->inner->size, __ATOMIC_RELAXED);
+}
+
+static inline void fc_finish(fc_req_t *r, bool ok)
+{
+    r->ok = ok;
+    __atomic_store_n(&r->state, FC_DONE, __ATOMIC_RELEASE);
+}
+
+/*
+ * Insert the k strings sv at the tail at once.  Should some fail to be
+ * allocated, the batch is dropped and the strings are inserted one at a
+ * time instead, so that each request learns whether its own made it.
+ */
+static void fc_insert_batch(fcqueue_t *fc,
+                            char **sv,
+                            fc_req_t **req,
+                            unsigned int k)
+{
+    if (k > 1 && q_insert_tail_many(fc->batch, sv, k, false) == (int) k) {
+        q_concat(fc->inner, fc->batch);
+        for (unsigned int i = 0; i < k; i++)
+            fc_finish(req[i], true);
+        return;
+    }
+    while (q_remove_head(fc->batch, NULL, 0))
+        ;
+    for (unsigned int i = 0; i < k; i++)
+        fc_finish(req[i], q_insert_tail(fc->inner, sv[i]));
+}
+
+/*
+ * Apply the published requests, with the lock held.  Removals run as
+ * they are found, and the insertions of each pass together at its end.
+ */
+static void fc_combine(queue_t *q, fcqueue_t *fc)
+{
+    char *sv[FC_SLOTS];
+    fc_req_t *ins[FC_SLOTS];
+    for (unsigned int pass = 0; pass < FC_PASSES; pass++) {
+        unsigned int k = 0, found = 0;
+        for (unsigned int i = 0; i < FC_SLOTS; i++) {
+            fc_req_t *r = &fc->slot[i].req;
+            switch (__atomic_load_n(&r->state, __ATOMIC_ACQUIRE)) {
+            case FC_INSERT:
+                sv[k] = r->s;
+                ins[k++] = r;
+                break;
+            case FC_REMOVE:
+                found++;
+                fc_finish(r, q_remove_head(fc->inner, r->sp, r->bufsize));
+                break;
+            case FC_TAKE:
+                found++;
+                r->taken = queue_take_block(fc->inner);
+                fc_finish(r, r->taken != NULL);
+                break;
+            }
+        }
+        if (k > 0)
+            fc_insert_batch(fc, sv, ins, k);
+        if (k + found == 0)
+            break;
+    }
+    fc_sync_size(q, fc);
+}
+
+static void fc_backoff(unsigned int *polls)
+{
+    if (++*polls < FC_SPIN) {
+        cpu_relax();
+    } else {
+        *polls = 0;
+        sched_yield();
+    }
+}
+
+/* Claim a free slot for the calling thread */
+static fc_req_t *fc_claim(fcqueue_t *fc)
+{
+    if (fc_hint == 0)
+        fc_hint = __atomic_add_fetch(&fc_threads, 1, __ATOMIC_RELAXED);
+    unsigned int polls = 0;
+    for (unsigned int i = fc_hint;; i++) {
+        fc_req_t *r = &fc->slot[i % FC_SLOTS].req;
+        int idle = FC_FREE;
+        if (__atomic_load_n(&r->state, __ATOMIC_RELAXED) == FC_FREE &&
+            __atomic_compare_exchange_n(&r->state, &idle, FC_BUSY, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return r;
+        fc_backoff(&polls);
+    }
+}
+
+/* Take the lock if nobody holds it, reading it before writing to it */
+static inline bool fc_trylock(fcqueue_t *fc)
+{
+    bool idle = false;
+    return !__atomic_load_n(&fc->lock, __ATOMIC_RELAXED) &&
+           __atomic_compare_exchange_n(&fc->lock, &idle, true, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+ * Publish the request filled in r as the given operation, and wait until
+ * it is carried out, combining whenever the lock is free.  The slot is
+ * given back once the caller has read the results.
+ */
+static void fc_submit(queue_t *q, fc_req_t *r, int op)
+{
+    fcqueue_t *fc = q->impl;
+    __atomic_store_n(&r->state, op, __ATOMIC_RELEASE);
+    unsigned int polls = 0;
+    while (__atomic_load_n(&r->state, __ATOMIC_ACQUIRE) != FC_DONE) {
+        if (fc_trylock(fc)) {
+            fc_combine(q, fc);
+            __atomic_store_n(&fc->lock, false, __ATOMIC_RELEASE);
+        } else {
+            fc_backoff(&polls);
+        }
+    }
+}
+
+static inline void fc_release(fc_req_t *r)
+{
+    __atomic_store_n(&r->state, FC_FREE, __ATOMIC_RELEASE);
+}
+
+static bool fc_insert_tail(queue_t *q, char *s)
+{
+    fc_req_t *r = fc_claim(q->impl);
+    r->s = s;
+    fc_submit(q, r, FC_INSERT);
+    bool ok = r->ok;
+    fc_release(r);
+    return ok;
+}
+
+static bool fc_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    fc_req_t *r = fc_claim(q->impl);
+    r->sp = sp;
+    r->bufsize = bufsize;
+    fc_submit(q, r, FC_REMOVE);
+    bool ok = r->ok;
+    fc_release(r);
+    return ok;
+}
+
+static char *fc_take_head(queue_t *q)
+{
+    fc_req_t *r = fc_claim(q->impl);
+    fc_submit(q, r, FC_TAKE);
+    char *s = r->taken;
+    fc_release(r);
+    return s;
+}
+
+/* The remaining operations need the queue to themselves */
+
+static bool fc_insert_head(queue_t *q, char *s)
+{
+    fcqueue_t *fc = q->impl;
+    bool ok = q_insert_head(fc->inner, s);
+    fc_sync_size(q, fc);
+    return ok;
+}
+
+static bool fc_concat(queue_t *dst, queue_t *src)
+{
+    fcqueue_t *d = dst->impl, *s = src->impl;
+    bool ok = q_concat(d->inner, s->inner);
+    fc_sync_size(dst, d);
+    fc_sync_size(src, s);
+    return ok;
+}
+
+static bool fc_split(queue_t *q, int k, queue_t *out)
+{
+    fcqueue_t *fc = q->impl, *o = out->impl;
+    bool ok = q_split(fc->inner, k, o->inner);
+    fc_sync_size(q, fc);
+    fc_sync_size(out, o);
+    return ok;
+}
+
+static void fc_reverse(queue_t *q)
+{
+    fcqueue_t *fc = q->impl;
+    q_reverse(fc->inner);
+}
+
+static void fc_sort(queue_t *q, q_cmp_t cmp)
+{
+    fcqueue_t *fc = q->impl;
+    q_sort_by(fc->inner, cmp);
+}
+
+static void fc_iter_init(queue_t *q, q_iter_t *it)
+{
+    fcqueue_t *fc = q->impl;
+    q_iter_init(fc->inner, it);
+}
+
+static char *fc_iter_next(queue_t *q, q_iter_t *it)
+{
+    fcqueue_t *fc = q->impl;
+    return q_iter_next(fc->inner, it);
+}
+
+const struct BACKEND combining_backend = {
+    .thread_safe = true,
+    .spsc_safe = true,
+    .init = fc_init,
+    .destroy = fc_destroy,
+    .insert_head = fc_insert_head,
+    .insert_tail = fc_insert_tail,
+    .remove_head = fc_remove_head,
+    .take_head = fc_take_head,
+    .concat = fc_concat,
+    .split = fc_split,
+    .reverse = fc_reverse,
+    .sort = fc_sort,
+    .iter_init = fc_iter_init,
+    .iter_next = fc_iter_next,
+};
@@ -0,0 +1,304 @@
+/*
+ * Doubly linked backend for Q_DEQUE queues.
+ *
+ * Nodes link to both neighbours, so strings come off either end in
+ * constant time.  Which link leads towards the tail depends on a
+ * direction bit of the whole queue: seen with dir 0, link[0] of a node
+ * is its successor, link[1] its predecessor, end[0] the head and end[1]
+ * the tail, and dir 1 swaps each of those pairs.  q_reverse then just
+ * flips the bit, leaving every node as it was.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+typedef struct DNODE {
+    struct DNODE *link[2];
+    char *value;
+} dnode_t;
+
+typedef struct {
+    dnode_t *end[2];
+    unsigned int dir; /* Set while the queue is seen reversed */
+} deque_t;
+
+/*
+ * Seen from a queue whose direction is dir, the head is at end[dir], the
+ * tail at end[!dir], and link[dir] of a node leads towards the tail.
+ * Below, p names an end, and a node at end p links inwards by link[p]
+ * and outwards by link[!p].
+ */
+
+static bool dq_init(queue_t *q)
+{
+    deque_t *d = malloc(sizeof(deque_t));
+    if (d == NULL)
+        return false;
+    d->end[0] = d->end[1] = NULL;
+    d->dir = 0;
+    q->impl = d;
+    return true;
+}
+
+static void dq_destroy(queue_t *q)
+{
+    deque_t *d = q->impl;
+    dnode_t *n = d->end[0];
+    while (n != NULL) {
+        dnode_t *next = n->link[0];
+        free(n->value);
+        free(n);
+        n = next;
+    }
+    free(d);
+}
+
+static bool dq_push(queue_t *q, unsigned int p, const char *s)
+{
+    deque_t *d = q->impl;
+    dnode_t *n = malloc(sizeof(dnode_t));
+    if (n == NULL)
+        return false;
+    n->value = strdup(s);
+    if (n->value == NULL) {
+        free(n);
+        return false;
+    }
+    n->link[p] = d->end[p];
+    n->link[!p] = NULL;
+    if (d->end[p] != NULL)
+        d->end[p]->link[!p] = n;
+    else
+        d->end[!p] = n;
+    d->end[p] = n;
+    q->size += 1;
+    return true;
+}
+
+/* Detach the string at end p, the caller frees it.  NULL if empty */
+static char *dq_pop(queue_t *q, unsigned int p)
+{
+    deque_t *d = q->impl;
+    dnode_t *n = d->end[p];
+    if (n == NULL)
+        return NULL;
+    d->end[p] = n->link[p];
+    if (d->end[p] != NULL)
+        d->end[p]->link[!p] = NULL;
+    else
+        d->end[!p] = NULL;
+    char *s = n->value;
+    free(n);
+    q->size -= 1;
+    return s;
+}
+
+static bool dq_remove(queue_t *q, unsigned int p, char *sp, size_t bufsize)
+{
+    char *s = dq_pop(q, p);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+static bool dq_insert_head(queue_t *q, char *s)
+{
+    deque_t *d = q->impl;
+    return dq_push(q, d->dir, s);
+}
+
+static bool dq_insert_tail(queue_t *q, char *s)
+{
+    deque_t *d = q->impl;
+    return dq_push(q, !d->dir, s);
+}
+
+static bool dq_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    deque_t *d = q->impl;
+    return dq_remove(q, d->dir, sp, bufsize);
+}
+
+static bool dq_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    deque_t *d = q->impl;
+    return dq_remove(q, !d->dir, sp, bufsize);
+}
+
+static char *dq_take_head(queue_t *q)
+{
+    deque_t *d = q->impl;
+    return dq_pop(q, d->dir);
+}
+
+static char *dq_peek_tail(queue_t *q)
+{
+    deque_t *d = q->impl;
+    dnode_t *tail = d->end[!d->dir];
+    return tail != NULL ? tail->value : NULL;
+}
+
+/*
+ * Append the chain from first to last, linked towards the tail by
+ * link[from], at the tail of d.  Nodes coming from a queue seen the other
+ * way round get their links swapped on the way.
+ */
+static void dq_append(deque_t *d,
+                      dnode_t *first,
+                      dnode_t *last,
+                      unsigned int from)
+{
+    unsigned int p = !d->dir;
+    if (from != d->dir) {
+        for (dnode_t *n = first; n != NULL;) {
+            dnode_t *next = n->link[from];
+            n->link[from] = n->link[!from];
+            n->link[!from] = next;
+            n = next;
+        }
+    }
+    first->link[p] = d->end[p];
+    if (d->end[p] != NULL)
+        d->end[p]->link[!p] = first;
+    else
+        d->end[!p] = first;
+    d->end[p] = last;
+}
+
+/*
+ * Moving a whole queue takes constant time, unless the two are seen in
+ * opposite directions and the nodes moved need their links swapped.
+ */
+static bool dq_concat(queue_t *dst, queue_t *src)
+{
+    deque_t *d = dst->impl, *s = src->impl;
+    if (src->size == 0)
+        return true;
+    dq_append(d, s->end[s->dir], s->end[!s->dir], s->dir);
+    s->end[0] = s->end[1] = NULL;
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+static bool dq_split(queue_t *q, int k, queue_t *out)
+{
+    deque_t *d = q->impl, *o = out->impl;
+    unsigned int dir = d->dir;
+    if (k == 0)
+        return true;
+    dnode_t *first = d->end[dir], *last = first;
+    for (int i = 1; i < k; i++)
+        last = last->link[dir];
+    d->end[dir] = last->link[dir];
+    if (d->end[dir] != NULL)
+        d->end[dir]->link[!dir] = NULL;
+    else
+        d->end[!dir] = NULL;
+    last->link[dir] = NULL;
+    dq_append(o, first, last, dir);
+    q->size -= k;
+    out->size += k;
+    return true;
+}
+
+static void dq_reverse(queue_t *q)
+{
+    deque_t *d = q->impl;
+    d->dir ^= 1;
+}
+
+/*
+ * Bottom-up merge sort along link[dir], as chain_sort() does, after
+ * which the links the other way are set up again in a single pass.
+ */
+static void dq_sort(queue_t *q, q_cmp_t cmp)
+{
+    deque_t *d = q->impl;
+    unsigned int dir = d->dir;
+    dnode_t *list = d->end[dir];
+    if (list == NULL)
+        return;
+    for (size_t width = 1;; width *= 2) {
+        dnode_t *a = list, *out = NULL, **link = &out;
+        unsigned int merges = 0;
+        while (a != NULL) {
+            dnode_t *b = a;
+            size_t alen = 0, blen = width;
+            while (alen < width && b != NULL) {
+                alen++;
+                b = b->link[dir];
+            }
+            while (alen > 0 || (blen > 0 && b != NULL)) {
+                dnode_t *n;
+                if (alen > 0 &&
+                    (blen == 0 || b == NULL || cmp(a->value, b->value) <= 0)) {
+                    n = a;
+                    a = a->link[dir];
+                    alen--;
+                } else {
+                    n = b;
+                    b = b->link[dir];
+                    blen--;
+                }
+                *link = n;
+                link = &n->link[dir];
+            }
+            a = b;
+            merges++;
+        }
+        *link = NULL;
+        list = out;
+        if (merges <= 1)
+            break;
+    }
+    dnode_t *prev = NULL;
+    for (dnode_t *n = list; n != NULL; n = n->link[dir]) {
+        n->link[!dir] = prev;
+        prev = n;
+    }
+    d->end[dir] = list;
+    d->end[!dir] = prev;
+}
+
+static void dq_iter_init(queue_t *q, q_iter_t *it)
+{
+    deque_t *d = q->impl;
+    it->node = d->end[d->dir];
+    it->idx = 0;
+}
+
+static char *dq_iter_next(queue_t *q, q_iter_t *it)
+{
+    deque_t *d = q->impl;
+    dnode_t *n = it->node;
+    if (n == NULL)
+        return NULL;
+    it->node = n->link[d->dir];
+    it->idx++;
+    return n->value;
+}
+
+const struct BACKEND deque_backend = {
+    .thread_safe = false,
+    .init = dq_init,
+    .destroy = dq_destroy,
+    .insert_head = dq_insert_head,
+    .insert_tail = dq_insert_tail,
+    .remove_head = dq_remove_head,
+    .remove_tail = dq_remove_tail,
+    .take_head = dq_take_head,
+    .peek_tail = dq_peek_tail,
+    .concat = dq_concat,
+    .split = dq_split,
+    .reverse = dq_reverse,
+    .sort = dq_sort,
+    .iter_init = dq_iter_init,
+    .iter_next = dq_iter_next,
+};
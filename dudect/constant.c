@@ -19,6 +19,7 @@ const int drop_size = 20;
  * we do not want the test to affect the original functionality
  */
 static queue_t *q = NULL;
+static q_kind_t dut_kind = Q_PLAIN;
 static char random_string[100][8];
 static int random_string_iter = 0;
 enum { test_insert_tail, test_size };
@@ -29,6 +30,11 @@ void init_dut(void)
     q = NULL;
 }
 
+void set_dut_kind(q_kind_t kind)
+{
+    dut_kind = kind;
+}
+
 char *get_random_string(void)
 {
     random_string_iter = (random_string_iter + 1) % number_measurements;
@@ -2,9 +2,11 @@
 #define DUDECT_CONSTANT_H
 
 #include <stdint.h>
-#define dut_new()    \
-    {                \
-        q = q_new(); \
+#include "queue.h"
+
+#define dut_new()                 \
+    {                             \
+        q = q_new_kind(dut_kind); \
     }
 
 #define dut_size(n)                                \
@@ -33,6 +35,8 @@
     }
 
 void init_dut();
+/* Create the queues under test as the given variant (default: Q_PLAIN) */
+void set_dut_kind(q_kind_t kind);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 void measure(int64_t *before_ticks,
              int64_t *after_ticks,
@@ -1,5 +1,6 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
@@ -43,16 +44,30 @@ typedef struct BELE {
 
 static block_ele_t *allocated = NULL;
 static size_t allocated_count = 0;
+/* Payload bytes of allocated blocks, and the most there were at once */
+static size_t allocated_bytes = 0;
+static size_t peak_bytes = 0;
+
+/*
+ * Serializes the bookkeeping of blocks, for queues shared by threads.
+ * Only taken in threaded mode: the alarm of a time-limited operation
+ * could otherwise jump out of an allocation with the lock still held.
+ */
+static pthread_mutex_t allocated_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool threaded_mode = false;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
+/* Scratch allocation still allowed in restricted allocation mode */
+static size_t noallocate_budget = 0;
+static void *noallocate_block = NULL;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+int time_limit = 1;
 
 /*
  * Data for managing exceptions
@@ -122,11 +137,15 @@ static size_t *find_footer(block_ele_t *b)
 /*
  * Implementation of application functions
  */
-void *test_malloc(size_t size)
+static void *block_alloc(size_t size)
 {
+    bool scratch = false;
     if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to malloc disallowed");
-        return NULL;
+        if (noallocate_block != NULL || size > noallocate_budget) {
+            report_event(MSG_FATAL, "Calls to malloc disallowed");
+            return NULL;
+        }
+        scratch = true;
     }
 
     if (fail_allocation()) {
@@ -157,7 +176,24 @@ void *test_malloc(size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    allocated_bytes += size;
+    if (allocated_bytes > peak_bytes)
+        peak_bytes = allocated_bytes;
+
+    if (scratch) {
+        noallocate_block = p;
+        noallocate_budget = 0;
+    }
+    return p;
+}
 
+void *test_malloc(size_t size)
+{
+    if (!threaded_mode)
+        return block_alloc(size);
+    pthread_mutex_lock(&allocated_lock);
+    void *p = block_alloc(size);
+    pthread_mutex_unlock(&allocated_lock);
     return p;
 }
 
@@ -173,11 +209,14 @@ void *test_calloc(size_t nelem, size_t elsize)
     return ptr;
 }
 
-void test_free(void *p)
+static void block_free(void *p)
 {
     if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to free disallowed");
-        return;
+        if (p == NULL || p != noallocate_block) {
+            report_event(MSG_FATAL, "Calls to free disallowed");
+            return;
+        }
+        noallocate_block = NULL;
     }
 
     if (!p)
@@ -206,10 +245,22 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
+    allocated_bytes -= b->payload_size;
     free(b);
     allocated_count--;
 }
 
+void test_free(void *p)
+{
+    if (!threaded_mode) {
+        block_free(p);
+        return;
+    }
+    pthread_mutex_lock(&allocated_lock);
+    block_free(p);
+    pthread_mutex_unlock(&allocated_lock);
+}
+
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
@@ -226,6 +277,19 @@ size_t allocation_check()
     return allocated_count;
 }
 
+size_t allocation_bytes()
+{
+    return allocated_bytes;
+}
+
+size_t allocation_peak(bool reset)
+{
+    size_t peak = peak_bytes;
+    if (reset)
+        peak_bytes = allocated_bytes;
+    return peak;
+}
+
 /*
  * Implementation of functions for testing
  */
@@ -239,6 +303,11 @@ void set_cautious_mode(bool cautious)
     cautious_mode = cautious;
 }
 
+void set_threaded_mode(bool threaded)
+{
+    threaded_mode = threaded;
+}
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
@@ -246,6 +315,17 @@ void set_cautious_mode(bool cautious)
 void set_noallocate_mode(bool noallocate)
 {
     noallocate_mode = noallocate;
+    noallocate_budget = 0;
+    noallocate_block = NULL;
+}
+
+/*
+ * Let a single allocation of at most size bytes, and freeing it again,
+ * through restricted allocation mode.  The budget ends with the mode.
+ */
+void set_noallocate_budget(size_t size)
+{
+    noallocate_budget = size;
 }
 
 /*
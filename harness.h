@@ -9,6 +9,8 @@
  * This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ * In threaded mode they take a lock, so threads sharing a queue may
+ * allocate at once.
  */
 
 void *test_malloc(size_t size);
@@ -22,21 +24,46 @@ char *test_strdup(const char *s);
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Report number of bytes requested by the allocated blocks */
+size_t allocation_bytes();
+
+/*
+ * Report the most bytes allocated at once since the last reset, then
+ * start over from the current amount if reset is true.
+ */
+size_t allocation_peak(bool reset);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Seconds a command with a time limit may run, or 0 for no limit */
+extern int time_limit;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Set/unset threaded mode, for while other threads may allocate.
+ * In this mode, allocation and freeing take a lock, so no operation
+ * with a time limit may run meanwhile.
+ */
+void set_threaded_mode(bool threaded);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
 void set_noallocate_mode(bool noallocate);
 
+/*
+ * Let a single allocation of at most size bytes, and freeing it again,
+ * through restricted allocation mode.  The budget ends with the mode.
+ */
+void set_noallocate_budget(size_t size);
+
 /*
   Return whether any errors have occurred since last time checked
  */
@@ -0,0 +1,142 @@
+/*
+ * Pool of interned strings.
+ *
+ * A chained hash table of entries, one per distinct string, each holding
+ * the string right after its reference count.  Interned strings are
+ * handed out as pointers into their entries, so dropping a reference
+ * finds the entry again without hashing.  The table doubles whenever it
+ * holds more entries than buckets, and is freed along with the last
+ * entry, leaving nothing allocated while no string is interned.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "intern.h"
+
+/* Buckets of the table when the first string comes in */
+#define INTERN_MIN_BUCKETS 64
+
+typedef struct ENTRY {
+    struct ENTRY *next; /* Next entry of the same bucket */
+    uint64_t hash;
+    size_t len;
+    size_t refs;
+    char str[];
+} entry_t;
+
+static entry_t **buckets = NULL;
+static size_t nbuckets = 0; /* A power of two, or 0 without a table */
+static size_t nentries = 0;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 64-bit FNV-1a hash of the len bytes at s */
+static uint64_t intern_hash(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline entry_t **intern_bucket(uint64_t hash)
+{
+    return &buckets[hash & (nbuckets - 1)];
+}
+
+/*
+ * Move every entry to a table of n buckets.  Lookups still work on the
+ * old table, only slower, if the new one could not be allocated.
+ */
+static void intern_rehash(size_t n)
+{
+    entry_t **fresh = malloc(sizeof(entry_t *) * n);
+    if (fresh == NULL)
+        return;
+    memset(fresh, 0, sizeof(entry_t *) * n);
+    for (size_t i = 0; i < nbuckets; i++) {
+        entry_t *e = buckets[i];
+        while (e != NULL) {
+            entry_t *next = e->next;
+            e->next = fresh[e->hash & (n - 1)];
+            fresh[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = fresh;
+    nbuckets = n;
+}
+
+char *intern_get(const char *s, size_t len)
+{
+    uint64_t hash = intern_hash(s, len);
+    pthread_mutex_lock(&intern_lock);
+    if (nbuckets == 0)
+        intern_rehash(INTERN_MIN_BUCKETS);
+    if (nbuckets == 0) {
+        pthread_mutex_unlock(&intern_lock);
+        return NULL;
+    }
+    entry_t *e = *intern_bucket(hash);
+    while (e != NULL && (e->hash != hash || e->len != len ||
+                         memcmp(e->str, s, len) != 0))
+        e = e->next;
+    if (e == NULL) {
+        e = malloc(sizeof(entry_t) + len + 1);
+        if (e == NULL) {
+            // Drop the table again if it was made for this string only
+            if (nentries == 0) {
+                free(buckets);
+                buckets = NULL;
+                nbuckets = 0;
+            }
+            pthread_mutex_unlock(&intern_lock);
+            return NULL;
+        }
+        e->hash = hash;
+        e->len = len;
+        e->refs = 0;
+        memcpy(e->str, s, len);
+        e->str[len] = '\0';
+        e->next = *intern_bucket(hash);
+        *intern_bucket(hash) = e;
+        if (++nentries > nbuckets)
+            intern_rehash(nbuckets * 2);
+    }
+    e->refs += 1;
+    pthread_mutex_unlock(&intern_lock);
+    return e->str;
+}
+
+void intern_put(char *s)
+{
+    entry_t *e = (entry_t *) (s - offsetof(entry_t, str));
+    pthread_mutex_lock(&intern_lock);
+    if (--e->refs == 0) {
+        entry_t **link = intern_bucket(e->hash);
+        while (*link != e)
+            link = &(*link)->next;
+        *link = e->next;
+        free(e);
+        if (--nentries == 0) {
+            free(buckets);
+            buckets = NULL;
+            nbuckets = 0;
+        }
+    }
+    pthread_mutex_unlock(&intern_lock);
+}
+
+size_t intern_count()
+{
+    pthread_mutex_lock(&intern_lock);
+    size_t n = nentries;
+    pthread_mutex_unlock(&intern_lock);
+    return n;
+}
@@ -0,0 +1,26 @@
+#ifndef LAB0_INTERN_H
+#define LAB0_INTERN_H
+
+/*
+ * Pool of interned strings, shared by every queue with interning on, see
+ * q_set_intern().  Each distinct string is stored once, along with the
+ * number of references to it, and is freed when the last one goes away.
+ * Safe to use from several threads at once.
+ */
+
+#include <stddef.h>
+
+/*
+ * Take a reference to the interned copy of string s of length len,
+ * interning it first if no copy exists yet.
+ * Return NULL if could not allocate space.
+ */
+char *intern_get(const char *s, size_t len);
+
+/* Drop a reference taken by intern_get() to interned string s */
+void intern_put(char *s);
+
+/* Number of distinct strings currently interned */
+size_t intern_count();
+
+#endif /* LAB0_INTERN_H */
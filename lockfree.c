@@ -0,0 +1,352 @@
+/*
+ * Lock-free backend for Q_LOCKFREE queues.
+ *
+ * Michael and Scott's queue: a chain of nodes behind a dummy node, with
+ * head pointing at the dummy and tail at the last node, or at the one
+ * before while an insertion is under way.  Insertion at the tail and
+ * removal at the head each swing a single pointer by compare-and-swap,
+ * so any number of producers and consumers may run at once.
+ *
+ * A removal turns the first node into the new dummy and retires the old
+ * one, which other threads may still be reading.  Retired nodes are only
+ * freed once no thread has them marked in its hazard pointers.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+typedef struct {
+    cnode_t *head; /* Dummy node */
+    char pad[CACHE_LINE - sizeof(cnode_t *)];
+    cnode_t *tail; /* Last node, or the one before it */
+} lfqueue_t;
+
+/*
+ * Hazard pointers.
+ * Every thread using lock-free queues owns a record, in which it marks
+ * the nodes it is about to read.  Nodes a thread retires pile up in its
+ * record until there are HP_SCAN of them, then those marked by nobody
+ * are freed.  Records of exited threads go back to the pool, along with
+ * any nodes that were still marked at the time.
+ */
+
+/* Most threads using lock-free queues at once */
+#define HP_MAX_THREADS 128
+
+/* Hazard pointers per thread: a node and its successor */
+#define HP_PER_THREAD 2
+
+/* Retired nodes per thread before a scan, over twice what can be marked */
+#define HP_SCAN (2 * HP_MAX_THREADS * HP_PER_THREAD)
+
+typedef struct {
+    cnode_t *hazard[HP_PER_THREAD];
+    bool active; /* Owned by a running thread */
+    unsigned int nretired;
+    cnode_t *retired[HP_SCAN];
+} hp_rec_t;
+
+static hp_rec_t hp_recs[HP_MAX_THREADS];
+static __thread hp_rec_t *hp_self;
+static pthread_key_t hp_key;
+static pthread_once_t hp_key_once = PTHREAD_ONCE_INIT;
+
+static int ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(cnode_t *const *) a;
+    uintptr_t y = (uintptr_t) *(cnode_t *const *) b;
+    return (x > y) - (x < y);
+}
+
+/* Free the nodes retired into rec that no thread has marked */
+static void hp_scan(hp_rec_t *rec)
+{
+    cnode_t *marked[HP_MAX_THREADS * HP_PER_THREAD];
+    size_t n = 0;
+    for (unsigned int i = 0; i < HP_MAX_THREADS; i++) {
+        for (unsigned int j = 0; j < HP_PER_THREAD; j++) {
+            cnode_t *h = __atomic_load_n(&hp_recs[i].hazard[j],
+                                         __ATOMIC_SEQ_CST);
+            if (h != NULL)
+                marked[n++] = h;
+        }
+    }
+    qsort(marked, n, sizeof(cnode_t *), ptr_cmp);
+
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < rec->nretired; i++) {
+        cnode_t *node = rec->retired[i];
+        if (bsearch(&node, marked, n, sizeof(cnode_t *), ptr_cmp) != NULL)
+            rec->retired[kept++] = node;
+        else
+            free(node);
+    }
+    rec->nretired = kept;
+}
+
+/* Take over a record nobody owns, return false if there was none */
+static bool hp_acquire(hp_rec_t *rec)
+{
+    bool idle = false;
+    return !__atomic_load_n(&rec->active, __ATOMIC_RELAXED) &&
+           __atomic_compare_exchange_n(&rec->active, &idle, true, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Hand back the record of an exiting thread */
+static void hp_release(void *arg)
+{
+    hp_rec_t *rec = arg;
+    for (unsigned int j = 0; j < HP_PER_THREAD; j++)
+        __atomic_store_n(&rec->hazard[j], NULL, __ATOMIC_RELEASE);
+    hp_scan(rec);
+    __atomic_store_n(&rec->active, false, __ATOMIC_RELEASE);
+}
+
+static void hp_key_create()
+{
+    pthread_key_create(&hp_key, hp_release);
+}
+
+/* Record of the calling thread, waiting for a free one on first use */
+static hp_rec_t *hp_get()
+{
+    if (hp_self != NULL)
+        return hp_self;
+    pthread_once(&hp_key_once, hp_key_create);
+    while (hp_self == NULL) {
+        for (unsigned int i = 0; i < HP_MAX_THREADS && hp_self == NULL; i++)
+            if (hp_acquire(&hp_recs[i]))
+                hp_self = &hp_recs[i];
+        if (hp_self == NULL)
+            sched_yield();
+    }
+    pthread_setspecific(hp_key, hp_self);
+    return hp_self;
+}
+
+/*
+ * Mark the node *src points to in hazard pointer i, and return it once
+ * *src is seen to still point to it, so that it cannot have been retired
+ * before being marked.
+ */
+static cnode_t *hp_protect(hp_rec_t *rec, unsigned int i, cnode_t **src)
+{
+    cnode_t *n = __atomic_load_n(src, __ATOMIC_SEQ_CST);
+    while (true) {
+        __atomic_store_n(&rec->hazard[i], n, __ATOMIC_SEQ_CST);
+        cnode_t *again = __atomic_load_n(src, __ATOMIC_SEQ_CST);
+        if (again == n)
+            return n;
+        n = again;
+    }
+}
+
+static inline void hp_clear(hp_rec_t *rec)
+{
+    for (unsigned int j = 0; j < HP_PER_THREAD; j++)
+        __atomic_store_n(&rec->hazard[j], NULL, __ATOMIC_RELEASE);
+}
+
+static void hp_retire(hp_rec_t *rec, cnode_t *node)
+{
+    rec->retired[rec->nretired++] = node;
+    if (rec->nretired == HP_SCAN)
+        hp_scan(rec);
+}
+
+/*
+ * Free what the calling thread and exited threads have retired, as far
+ * as running threads do not have it marked.
+ */
+static void hp_collect()
+{
+    hp_rec_t *self = hp_get();
+    hp_scan(self);
+    for (unsigned int i = 0; i < HP_MAX_THREADS; i++) {
+        hp_rec_t *rec = &hp_recs[i];
+        if (rec != self && hp_acquire(rec)) {
+            hp_scan(rec);
+            __atomic_store_n(&rec->active, false, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static bool lf_init(queue_t *q)
+{
+    lfqueue_t *lf = malloc(sizeof(lfqueue_t));
+    if (lf == NULL)
+        return false;
+    lf->head = malloc(sizeof(cnode_t));
+    if (lf->head == NULL) {
+        free(lf);
+        return false;
+    }
+    lf->head->next = NULL;
+    lf->head->value = NULL;
+    lf->tail = lf->head;
+    q->impl = lf;
+    return true;
+}
+
+static void lf_destroy(queue_t *q)
+{
+    lfqueue_t *lf = q->impl;
+    chain_free(lf->head);
+    free(lf);
+    hp_collect();
+}
+
+static bool lf_insert_tail(queue_t *q, char *s)
+{
+    lfqueue_t *lf = q->impl;
+    cnode_t *n = chain_node(s);
+    if (n == NULL)
+        return false;
+    hp_rec_t *rec = hp_get();
+    /* Counted before it can be removed, so the size never underflows */
+    __atomic_fetch_add(&q->size, 1, __ATOMIC_RELAXED);
+    while (true) {
+        cnode_t *tail = hp_protect(rec, 0, &lf->tail);
+        cnode_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (next != NULL) {
+            /* Finish the insertion that got there first */
+            __atomic_compare_exchange_n(&lf->tail, &tail, next, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&tail->next, &next, n, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            __atomic_compare_exchange_n(&lf->tail, &tail, n, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    hp_clear(rec);
+    return true;
+}
+
+static char *lf_take_head(queue_t *q)
+{
+    lfqueue_t *lf = q->impl;
+    hp_rec_t *rec = hp_get();
+    cnode_t *head, *next;
+    while (true) {
+        head = hp_protect(rec, 0, &lf->head);
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&rec->hazard[1], next, __ATOMIC_SEQ_CST);
+        /* next cannot have been retired while head is still the dummy */
+        if (__atomic_load_n(&lf->head, __ATOMIC_SEQ_CST) != head)
+            continue;
+        if (next == NULL)
+            break;
+        cnode_t *tail = __atomic_load_n(&lf->tail, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            /* Never let head pass a lagging tail */
+            __atomic_compare_exchange_n(&lf->tail, &tail, next, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&lf->head, &head, next, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            break;
+    }
+    /* The new dummy keeps its value pointer, which is ours from now on */
+    char *s = next != NULL ? next->value : NULL;
+    hp_clear(rec);
+    if (s != NULL) {
+        __atomic_fetch_sub(&q->size, 1, __ATOMIC_RELAXED);
+        hp_retire(rec, head);
+    }
+    return s;
+}
+
+static bool lf_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    char *s = lf_take_head(q);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+/*
+ * The remaining operations need the queue to themselves, when the tail
+ * is always the last node.
+ */
+
+static bool lf_insert_head(queue_t *q, char *s)
+{
+    lfqueue_t *lf = q->impl;
+    if (!chain_push(&lf->head, s))
+        return false;
+    q->size += 1;
+    return true;
+}
+
+static bool lf_concat(queue_t *dst, queue_t *src)
+{
+    lfqueue_t *d = dst->impl, *s = src->impl;
+    chain_move(s->head, &s->tail, s->tail, &d->tail);
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+static bool lf_split(queue_t *q, int k, queue_t *out)
+{
+    lfqueue_t *l = q->impl, *o = out->impl;
+    chain_move(l->head, &l->tail, chain_at(l->head, k), &o->tail);
+    q->size -= k;
+    out->size += k;
+    return true;
+}
+
+static void lf_reverse(queue_t *q)
+{
+    lfqueue_t *lf = q->impl;
+    lf->tail = chain_reverse(lf->head);
+}
+
+static void lf_sort(queue_t *q, q_cmp_t cmp)
+{
+    lfqueue_t *lf = q->impl;
+    lf->tail = chain_sort(lf->head, cmp);
+}
+
+static void lf_iter_init(queue_t *q, q_iter_t *it)
+{
+    lfqueue_t *lf = q->impl;
+    it->node = lf->head->next;
+    it->idx = 0;
+}
+
+static char *lf_iter_next(queue_t *q, q_iter_t *it)
+{
+    return chain_iter_next(it);
+}
+
+const struct BACKEND lockfree_backend = {
+    .thread_safe = true,
+    .spsc_safe = true,
+    .init = lf_init,
+    .destroy = lf_destroy,
+    .insert_head = lf_insert_head,
+    .insert_tail = lf_insert_tail,
+    .remove_head = lf_remove_head,
+    .take_head = lf_take_head,
+    .concat = lf_concat,
+    .split = lf_split,
+    .reverse = lf_reverse,
+    .sort = lf_sort,
+    .iter_init = lf_iter_init,
+    .iter_next = lf_iter_next,
+};
@@ -1,8 +1,11 @@
 /* Implementation of testing code for queue code */
 
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +14,7 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
 
 /* Our program needs to use regular malloc/free */
@@ -32,7 +36,9 @@
 #include "queue.h"
 
 #include "console.h"
+#include "intern.h"
 #include "report.h"
+#include "strnatcmp.h"
 
 /* Settable parameters */
 
@@ -52,12 +58,83 @@ static queue_t *q = NULL;
 /* Number of elements in queue */
 static size_t qcnt = 0;
 
+/* Queue receiving the elements split off the queue being tested */
+static queue_t *side = NULL;
+static size_t side_cnt = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_QUEUE;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Whether new queues allocate their elements from a node pool */
+static int pool_mode = 0;
+
+/* Whether new queues intern their strings */
+static int intern_mode = 0;
+
+/* Number of threads of sort parallel, and most tried by sortscale */
+static int sort_threads = 1;
+
+/* Whether stress locks around operations even on thread-safe queues */
+static int stress_lock = 0;
+
+/* Capacity of new bounded and spsc queues */
+static int bounded_capacity = Q_BOUNDED_CAPACITY;
+
+/* Milliseconds it and rh wait on a full or empty bounded queue */
+static int wait_ms = 0;
+
+/* Queue variants that can be requested by name with the new command */
+static const struct {
+    char *name;
+    q_kind_t kind;
+} queue_kinds[] = {
+    {"plain", Q_PLAIN},
+    {"pool", Q_POOL},
+    {"arena", Q_ARENA},
+    {"unrolled", Q_UNROLLED},
+    {"ring", Q_RING},
+    {"lockfree", Q_LOCKFREE},
+    {"twolock", Q_TWOLOCK},
+    {"bounded", Q_BOUNDED},
+    {"spsc", Q_SPSC},
+    {"combining", Q_COMBINING},
+    {"deque", Q_DEQUE},
+};
+
+/* Sort algorithms that can be requested by name with the sort command */
+static const struct {
+    char *name;
+    q_sort_mode_t mode;
+    q_cmp_t order; /* Order the algorithm sorts in */
+    bool parallel; /* Merge sort with option threads threads instead */
+} sort_modes[] = {
+    {"merge", Q_SORT_MERGE, q_cmp_natural, false},
+    {"key", Q_SORT_KEYED, q_cmp_natural, false},
+    {"radix", Q_SORT_RADIX, q_cmp_bytes, false},
+    {"gather", Q_SORT_GATHER, q_cmp_natural, false},
+    {"parallel", Q_SORT_MERGE, q_cmp_natural, true},
+};
+
+/* Orders that can be requested by name with the sort command */
+static const struct {
+    char *name;
+    q_cmp_t cmp;
+} sort_orders[] = {
+    {"bytes", q_cmp_bytes},
+    {"nocase", q_cmp_nocase},
+    {"natural", q_cmp_natural},
+    {"natural-nocase", q_cmp_natural_nocase},
+    {"length", q_cmp_length},
+    {"bytes-desc", q_cmp_bytes_desc},
+    {"nocase-desc", q_cmp_nocase_desc},
+    {"natural-desc", q_cmp_natural_desc},
+    {"natural-nocase-desc", q_cmp_natural_nocase_desc},
+    {"length-desc", q_cmp_length_desc},
+};
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -70,16 +147,31 @@ static bool do_insert_head(int argc, char *argv[]);
 static bool do_insert_tail(int argc, char *argv[]);
 static bool do_remove_head(int argc, char *argv[]);
 static bool do_remove_head_quiet(int argc, char *argv[]);
+static bool do_take_head(int argc, char *argv[]);
+static bool do_remove_tail(int argc, char *argv[]);
+static bool do_remove_head_many(int argc, char *argv[]);
+static bool do_split(int argc, char *argv[]);
+static bool do_concat(int argc, char *argv[]);
 static bool do_reverse(int argc, char *argv[]);
 static bool do_size(int argc, char *argv[]);
 static bool do_sort(int argc, char *argv[]);
 static bool do_show(int argc, char *argv[]);
+static bool do_mem(int argc, char *argv[]);
+static bool do_natcheck(int argc, char *argv[]);
+static bool do_sortscale(int argc, char *argv[]);
+static bool do_stress(int argc, char *argv[]);
+static bool do_pipeline(int argc, char *argv[]);
+static bool do_handoff(int argc, char *argv[]);
 
 static void queue_init();
 
 static void console_init()
 {
-    add_cmd("new", do_new, "                | Create new queue");
+    add_cmd("new", do_new,
+            " [kind]         | Create new queue.  Kind is one of plain, pool, "
+            "arena, unrolled, ring, lockfree, twolock, bounded, spsc, "
+            "combining or deque (default: plain, or pool if option pool is "
+            "set)");
     add_cmd("free", do_free, "                | Delete queue");
     add_cmd("ih", do_insert_head,
             " str [n]        | Insert string str at head of queue n times. "
@@ -93,35 +185,129 @@ static void console_init()
     add_cmd(
         "rhq", do_remove_head_quiet,
         "                | Remove from head of queue without reporting value.");
+    add_cmd("rht", do_take_head,
+            " [str]          | Remove from head of queue, taking over its "
+            "string instead of copying it.  Optionally compare to expected "
+            "value str");
+    add_cmd("rt", do_remove_tail,
+            " [str]          | Remove from tail of queue.  Optionally compare "
+            "to expected value str");
+    add_cmd("rhn", do_remove_head_many,
+            " n              | Remove n elements from head of queue at once, "
+            "draining their strings into a single buffer");
+    add_cmd("split", do_split,
+            " k              | Move the first k elements of queue to the tail "
+            "of a side queue");
+    add_cmd("concat", do_concat,
+            "                | Move all elements of the side queue to the "
+            "tail of queue");
     add_cmd("reverse", do_reverse, "                | Reverse queue");
-    add_cmd("sort", do_sort, "                | Sort queue in ascending order");
+    add_cmd("sort", do_sort,
+            " [mode|order]   | Sort queue in ascending order.  Mode is merge "
+            "(default), key, gather, radix for byte order, or parallel.  "
+            "Order is bytes, nocase, natural, natural-nocase or length, "
+            "each with a -desc variant");
     add_cmd("size", do_size,
             " [n]            | Compute queue size n times (default: n == 1)");
     add_cmd("show", do_show, "                | Show queue contents");
+    add_cmd("mem", do_mem,
+            "                | Report the bytes allocated now, the most "
+            "allocated at once since the last mem, and the strings interned");
+    add_cmd("natcheck", do_natcheck,
+            " [n]            | Check strnatxfrm against strnatcmp on n random "
+            "pairs of strings (default: n == 100000)");
+    add_cmd("sortscale", do_sortscale,
+            " [n]            | Time sort parallel of n random strings with 1 "
+            "up to option threads threads (default: n == 1000000)");
+    add_cmd("stress", do_stress,
+            " p c [n]        | Insert n strings from each of p threads at the "
+            "tail of the empty queue while c threads remove them from the "
+            "head, then check each was removed once.  Queues these threads "
+            "may not share get locked around every operation (default: n == "
+            "100000)");
+    add_cmd("pipeline", do_pipeline,
+            " p c [n]        | Like stress, but threads wait while a bounded "
+            "queue is full or empty, and percentiles of the end-to-end "
+            "latency from insertion to removal, waits included, are "
+            "reported");
+    add_cmd("handoff", do_handoff,
+            " [n]            | Pass n strings from one thread to another "
+            "through the empty queue, reporting throughput, then the cycles "
+            "each of up to 10000 strings sent one at a time takes to cross "
+            "(default: n == 1000000)");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("time", &time_limit,
+              "Seconds a queue operation may run, or 0 for no limit", NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("pool", &pool_mode,
+              "Allocate elements of new queues from a per-queue node pool",
+              NULL);
+    add_param("threads", &sort_threads, "Number of threads of sort parallel",
+              NULL);
+    add_param("capacity", &bounded_capacity,
+              "Most elements new bounded and spsc queues hold", NULL);
+    add_param("wait", &wait_ms,
+              "Milliseconds it and rh wait while a bounded queue is full or "
+              "empty, free of the time limit",
+              NULL);
+    add_param("intern", &intern_mode,
+              "Intern the long strings of new plain and pool queues instead "
+              "of copying them",
+              NULL);
+    add_param("lock", &stress_lock,
+              "Take a single lock around every operation of stress, even on "
+              "thread-safe queues",
+              NULL);
+}
+
+/* Return the string at the head of the queue being tested */
+static char *queue_head()
+{
+    return q_peek_head(q);
 }
 
 static bool do_new(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
     }
 
+    q_kind_t kind = pool_mode ? Q_POOL : Q_PLAIN;
+    if (argc == 2) {
+        size_t i = 0;
+        while (i < sizeof(queue_kinds) / sizeof(queue_kinds[0]) &&
+               strcmp(argv[1], queue_kinds[i].name))
+            i++;
+        if (i == sizeof(queue_kinds) / sizeof(queue_kinds[0])) {
+            report(1, "Unknown queue kind '%s'", argv[1]);
+            return false;
+        }
+        kind = queue_kinds[i].kind;
+    }
+    /* Simulation mode measures the same variant */
+    set_dut_kind(kind);
+
     bool ok = true;
     if (q) {
         report(3, "Freeing old queue");
-        ok = do_free(argc, argv);
+        ok = do_free(1, argv);
     }
     error_check();
 
-    if (exception_setup(true))
-        q = q_new();
+    if (exception_setup(true)) {
+        if (kind == Q_BOUNDED)
+            q = q_new_bounded(bounded_capacity > 0 ? bounded_capacity : 1);
+        else if (kind == Q_SPSC)
+            q = q_new_spsc(bounded_capacity > 0 ? bounded_capacity : 1);
+        else
+            q = q_new_kind(kind);
+        q_set_intern(q, intern_mode);
+    }
     exception_cancel();
     qcnt = 0;
     show_queue(3);
@@ -141,15 +327,19 @@ static bool do_free(int argc, char *argv[])
         report(3, "Warning: Calling free on null queue");
     error_check();
 
-    if (qcnt > big_queue_size)
+    if (qcnt + side_cnt > big_queue_size)
         set_cautious_mode(false);
-    if (exception_setup(true))
+    if (exception_setup(true)) {
+        q_free(side);
         q_free(q);
+    }
     exception_cancel();
     set_cautious_mode(true);
 
     q = NULL;
     qcnt = 0;
+    side = NULL;
+    side_cnt = 0;
     show_queue(3);
 
     size_t bcnt = allocation_check();
@@ -177,6 +367,86 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/*
+ * Account for an insertion of string s that failed.
+ * Return false once more insertions failed than allowed.
+ */
+static bool insertion_failed(char *s)
+{
+    fail_count++;
+    if (fail_count < fail_limit) {
+        report(2, "Insertion of %s failed", s);
+        return true;
+    }
+    report(1, "ERROR: Insertion of %s failed (%d failures total)", s,
+           fail_count);
+    return false;
+}
+
+/* Number of random strings generated for each bulk insertion */
+#define RAND_BATCH 1024
+
+/*
+ * Insert reps copies of string inserts, or reps random strings if
+ * need_rand, at the head or at the tail of the queue with the bulk
+ * insertion API.  Return false on error.
+ */
+static bool insert_many(bool at_head, char *inserts, bool need_rand, int reps)
+{
+    static char rand_buf[RAND_BATCH][MAX_RANDSTR_LEN];
+    static char *rand_sv[RAND_BATCH];
+    bool ok = true;
+    int done = 0;
+    while (ok && done < reps) {
+        char **sv = &inserts;
+        int n = reps - done;
+        if (need_rand) {
+            if (n > RAND_BATCH)
+                n = RAND_BATCH;
+            for (int i = 0; i < n; i++) {
+                fill_rand_string(rand_buf[i], sizeof(rand_buf[i]));
+                rand_sv[i] = rand_buf[i];
+            }
+            sv = rand_sv;
+        }
+        int cnt = at_head ? q_insert_head_many(q, sv, n, !need_rand)
+                          : q_insert_tail_many(q, sv, n, !need_rand);
+        done += n;
+        qcnt += cnt;
+
+        if (cnt > 0) {
+            q_iter_t it;
+            q_iter_init(q, &it);
+            char *head = q_iter_next(q, &it);
+            char *second = q_iter_next(q, &it);
+            if (!head) {
+                report(1, "ERROR: Failed to save copy of string in list");
+                ok = false;
+            } else if (at_head) {
+                for (int i = 0; ok && i < (need_rand ? n : 1); i++) {
+                    if (head == sv[i]) {
+                        report(1,
+                               "ERROR: Need to allocate and copy string for "
+                               "new list element");
+                        ok = false;
+                    }
+                }
+                /* Unless equal strings are interned, and so shared */
+                if (ok && cnt > 1 && head == second && !q->intern) {
+                    report(1,
+                           "ERROR: Need to allocate separate string for each "
+                           "list element");
+                    ok = false;
+                }
+            }
+        }
+        for (int i = cnt; ok && i < n; i++)
+            ok = insertion_failed(need_rand ? "RAND" : inserts);
+        ok = ok && !error_check();
+    }
+    return ok;
+}
+
 static bool do_insert_head(int argc, char *argv[])
 {
     char *lasts = NULL;
@@ -205,6 +475,14 @@ static bool do_insert_head(int argc, char *argv[])
         report(3, "Warning: Calling insert head on null queue");
     error_check();
 
+    if (reps > 1) {
+        if (exception_setup(true))
+            ok = insert_many(true, inserts, need_rand, reps);
+        exception_cancel();
+        show_queue(3);
+        return ok;
+    }
+
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
@@ -212,33 +490,26 @@ static bool do_insert_head(int argc, char *argv[])
             bool rval = q_insert_head(q, inserts);
             if (rval) {
                 qcnt++;
-                if (!q->head->value) {
+                char *head = queue_head();
+                if (!head) {
                     report(1, "ERROR: Failed to save copy of string in list");
                     ok = false;
-                } else if (r == 0 && inserts == q->head->value) {
+                } else if (r == 0 && inserts == head) {
                     report(1,
                            "ERROR: Need to allocate and copy string for new "
                            "list element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == q->head->value) {
+                } else if (r == 1 && lasts == head && !q->intern) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "list element");
                     ok = false;
                     break;
                 }
-                lasts = q->head->value;
+                lasts = head;
             } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
-                }
+                ok = insertion_failed(inserts);
             }
             ok = ok && !error_check();
         }
@@ -290,27 +561,29 @@ static bool do_insert_tail(int argc, char *argv[])
         report(3, "Warning: Calling insert tail on null queue");
     error_check();
 
-    if (exception_setup(true)) {
+    if (reps > 1) {
+        if (exception_setup(true))
+            ok = insert_many(false, inserts, need_rand, reps);
+        exception_cancel();
+        show_queue(3);
+        return ok;
+    }
+
+    /* Waiting goes without the time limit, which would cut it short */
+    if (exception_setup(wait_ms <= 0)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = q_insert_tail(q, inserts);
+            bool rval = wait_ms > 0 ? q_insert_tail_wait(q, inserts, wait_ms)
+                                    : q_insert_tail(q, inserts);
             if (rval) {
                 qcnt++;
-                if (!q->head->value) {
+                if (!queue_head()) {
                     report(1, "ERROR: Failed to save copy of string in list");
                     ok = false;
                 }
             } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
-                }
+                ok = insertion_failed(inserts);
             }
             ok = ok && !error_check();
         }
@@ -320,7 +593,17 @@ static bool do_insert_tail(int argc, char *argv[])
     return ok;
 }
 
-static bool do_remove_head(int argc, char *argv[])
+/* How rh, rht and rt remove an element */
+typedef enum { REMOVE_HEAD, TAKE_HEAD, REMOVE_TAIL } remove_how_t;
+
+/*
+ * Common part of rh, rht and rt.  With TAKE_HEAD, the string is taken
+ * over with q_take_head() and copied to the removes buffer here, so that
+ * it goes through the same checks as one copied by q_remove_head().
+ * With REMOVE_TAIL, the string removed must be the one q_peek_tail()
+ * showed just before.
+ */
+static bool remove_element(int argc, char *argv[], remove_how_t how)
 {
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
@@ -335,12 +618,16 @@ static bool do_remove_head(int argc, char *argv[])
     }
 
     char *checks = malloc(string_length + 1);
-    if (!checks) {
+    char *peeked = malloc(string_length + 1);
+    if (!checks || !peeked) {
         report(1,
                "INTERNAL ERROR.  Could not allocate space for removed strings");
         free(removes);
+        free(checks);
+        free(peeked);
         return false;
     }
+    const char *end = how == REMOVE_TAIL ? "tail" : "head";
 
     bool check = argc > 1;
     bool ok = true;
@@ -354,14 +641,41 @@ static bool do_remove_head(int argc, char *argv[])
     removes[string_length + STRINGPAD] = '\0';
 
     if (!q)
-        report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
-        report(3, "Warning: Calling remove head on empty queue");
+        report(3, "Warning: Calling remove %s on null queue", end);
+    else if (!q_size(q))
+        report(3, "Warning: Calling remove %s on empty queue", end);
     error_check();
 
+    peeked[0] = '\0';
+    if (how == REMOVE_TAIL && q && q_size(q) > 0) {
+        strncpy(peeked, q_peek_tail(q), string_length + 1);
+        peeked[string_length] = '\0';
+    }
+
     bool rval = false;
-    if (exception_setup(true))
-        rval = q_remove_head(q, removes, string_length + 1);
+    q_taken_t taken;
+    /* Waiting goes without the time limit, which would cut it short */
+    if (exception_setup(how != REMOVE_HEAD || wait_ms <= 0)) {
+        if (how == REMOVE_TAIL) {
+            rval = q_remove_tail(q, removes, string_length + 1);
+        } else if (how == REMOVE_HEAD) {
+            rval = wait_ms > 0 ? q_remove_head_wait(q, removes,
+                                                    string_length + 1, wait_ms)
+                               : q_remove_head(q, removes, string_length + 1);
+        } else if ((rval = q_take_head(q, &taken))) {
+            size_t len = strlen(taken.value);
+            if (len != taken.len) {
+                report(1, "ERROR: Taken string has length %zu, not %zu", len,
+                       taken.len);
+                ok = false;
+            }
+            if (len > (size_t) string_length)
+                len = string_length;
+            memcpy(removes, taken.value, len);
+            removes[len] = '\0';
+            q_release_taken(q, &taken);
+        }
+    }
     exception_cancel();
 
     if (rval) {
@@ -380,8 +694,9 @@ static bool do_remove_head(int argc, char *argv[])
             i++;
         if (i != string_length + STRINGPAD) {
             report(1,
-                   "ERROR: copying of string in remove_head overflowed "
-                   "destination buffer.");
+                   "ERROR: copying of string in remove_%s overflowed "
+                   "destination buffer.",
+                   end);
             ok = false;
         } else {
             report(2, "Removed %s from queue", removes);
@@ -398,6 +713,12 @@ static bool do_remove_head(int argc, char *argv[])
         }
     }
 
+    if (ok && rval && how == REMOVE_TAIL && strcmp(removes, peeked)) {
+        report(1, "ERROR: Removed value %s != tail value %s", removes,
+               peeked);
+        ok = false;
+    }
+
     if (ok && check && strcmp(removes, checks)) {
         report(1, "ERROR: Removed value %s != expected value %s", removes,
                checks);
@@ -408,9 +729,25 @@ static bool do_remove_head(int argc, char *argv[])
 
     free(removes);
     free(checks);
+    free(peeked);
     return ok && !error_check();
 }
 
+static bool do_remove_head(int argc, char *argv[])
+{
+    return remove_element(argc, argv, REMOVE_HEAD);
+}
+
+static bool do_take_head(int argc, char *argv[])
+{
+    return remove_element(argc, argv, TAKE_HEAD);
+}
+
+static bool do_remove_tail(int argc, char *argv[])
+{
+    return remove_element(argc, argv, REMOVE_TAIL);
+}
+
 static bool do_remove_head_quiet(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -421,7 +758,7 @@ static bool do_remove_head_quiet(int argc, char *argv[])
     bool ok = true;
     if (!q)
         report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
+    else if (!q_size(q))
         report(3, "Warning: Calling remove head on empty queue");
     error_check();
 
@@ -447,6 +784,272 @@ static bool do_remove_head_quiet(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Buffer the rhn command drains strings into, reused across commands */
+#define DRAIN_BUFSIZE (64 * 1024)
+
+/* Maximum number of strings drained by one call */
+#define DRAIN_MAX 4096
+
+static bool do_remove_head_many(int argc, char *argv[])
+{
+    static char drained[DRAIN_BUFSIZE];
+    static size_t offsets[DRAIN_MAX];
+
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int reps = 0;
+    if (!get_int(argv[1], &reps)) {
+        report(1, "Invalid number of removals '%s'", argv[1]);
+        return false;
+    }
+
+    bool ok = true;
+    if (!q)
+        report(3, "Warning: Calling remove head on null queue");
+    else if (!q_size(q))
+        report(3, "Warning: Calling remove head on empty queue");
+    error_check();
+
+    int removed = 0;
+    if (exception_setup(true)) {
+        while (ok && removed < reps) {
+            int n = reps - removed < DRAIN_MAX ? reps - removed : DRAIN_MAX;
+            int cnt =
+                q_remove_head_many(q, drained, DRAIN_BUFSIZE, offsets, n);
+            if (cnt == 0)
+                break;
+            removed += cnt;
+            qcnt -= cnt;
+
+            /* Each string must start past the end of the previous one */
+            size_t end = 0;
+            for (int i = 0; ok && i < cnt; i++) {
+                char *nul = NULL;
+                if (offsets[i] >= end && offsets[i] < DRAIN_BUFSIZE)
+                    nul = memchr(drained + offsets[i], '\0',
+                                 DRAIN_BUFSIZE - offsets[i]);
+                if (!nul) {
+                    report(1,
+                           "ERROR: Removed string %d not properly stored in "
+                           "drain buffer",
+                           removed - cnt + i);
+                    ok = false;
+                } else {
+                    end = nul - drained + 1;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (ok && removed < reps) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Removed only %d of %d elements", removed, reps);
+        else {
+            report(1, "ERROR: Removal failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    } else if (ok) {
+        report(2, "Removed %d elements from queue", removed);
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/*
+ * Collect the strings of queue a followed by those of queue b, which are
+ * expected to hold na and nb of them.  Return NULL if they do not.
+ */
+static char **gather_strings(queue_t *a, size_t na, queue_t *b, size_t nb)
+{
+    char **sv = malloc(sizeof(char *) * (na + nb + 1));
+    if (!sv) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for strings");
+        return NULL;
+    }
+    size_t n = 0;
+    q_iter_t it;
+    if (a) {
+        q_iter_init(a, &it);
+        while (n <= na && (sv[n] = q_iter_next(a, &it)))
+            n++;
+    }
+    if (b && n == na) {
+        q_iter_init(b, &it);
+        while (n <= na + nb && (sv[n] = q_iter_next(b, &it)))
+            n++;
+    }
+    if (n != na + nb) {
+        report(1, "ERROR: Queues do not hold %zu elements", na + nb);
+        free(sv);
+        return NULL;
+    }
+    return sv;
+}
+
+/*
+ * Check that queue qq holds exactly the n strings of sv, at the same
+ * addresses, meaning that none of them has been copied.
+ */
+static bool check_strings(queue_t *qq, char **sv, size_t n, const char *name)
+{
+    if (q_size(qq) != (int) n) {
+        report(1,
+               "ERROR: Computed %s queue size as %d, but correct value is %d",
+               name, q_size(qq), (int) n);
+        return false;
+    }
+    bool ok = true;
+    size_t i = 0;
+    if (exception_setup(true)) {
+        q_iter_t it;
+        q_iter_init(qq, &it);
+        char *e;
+        while (ok && (e = q_iter_next(qq, &it))) {
+            if (i == n) {
+                report(1,
+                       "ERROR:  Either %s list has cycle, or queue has more "
+                       "than %zu elements",
+                       name, n);
+                ok = false;
+            } else if (e != sv[i]) {
+                report(1,
+                       "ERROR: Element %zu of %s queue is not the one "
+                       "expected there",
+                       i, name);
+                ok = false;
+            }
+            i++;
+        }
+    }
+    exception_cancel();
+    if (ok && i < n) {
+        report(1, "ERROR: Found only %zu of %zu elements in %s queue", i, n,
+               name);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool do_split(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int k = 0;
+    if (!get_int(argv[1], &k)) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling split on null queue");
+    else if (k > (int) qcnt)
+        report(3, "Warning: Splitting off more elements than queue holds");
+    error_check();
+
+    if (q && !side) {
+        if (exception_setup(true)) {
+            side = q_new_kind(q->kind);
+            q_set_intern(side, q->intern);
+        }
+        exception_cancel();
+        side_cnt = 0;
+    }
+
+    /* Where the strings should end up: side queue first, then q */
+    char **sv = NULL;
+    if (q && side && !(sv = gather_strings(side, side_cnt, q, qcnt)))
+        return false;
+
+    bool ok = true;
+    bool rval = false;
+    if (exception_setup(true))
+        rval = q_split(q, k, side);
+    exception_cancel();
+
+    if (rval) {
+        side_cnt += k;
+        qcnt -= k;
+        report(2, "Split %d elements off queue", k);
+        ok = check_strings(side, sv, side_cnt, "side") &&
+             check_strings(q, sv + side_cnt, qcnt, "split");
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Split of queue failed");
+        } else {
+            report(1, "ERROR: Split of queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    free(sv);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_concat(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling concat on null queue");
+    else if (!side)
+        report(3, "Warning: Calling concat without a side queue");
+    error_check();
+
+    char **sv = NULL;
+    if (q && side && !(sv = gather_strings(q, qcnt, side, side_cnt)))
+        return false;
+
+    bool ok = true;
+    bool rval = false;
+    if (exception_setup(true))
+        rval = q_concat(q, side);
+    exception_cancel();
+
+    if (rval) {
+        report(2, "Moved %d elements to queue", (int) side_cnt);
+        qcnt += side_cnt;
+        side_cnt = 0;
+        ok = check_strings(q, sv, qcnt, "concatenated") &&
+             check_strings(side, sv, 0, "side");
+        /* The emptied side queue must give nothing of q back on free */
+        if (exception_setup(true))
+            q_free(side);
+        exception_cancel();
+        side = NULL;
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Concatenation of queues failed");
+        } else {
+            report(1,
+                   "ERROR: Concatenation of queues failed (%d failures "
+                   "total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    free(sv);
+    show_queue(3);
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -533,11 +1136,33 @@ static bool do_size(int argc, char *argv[])
 
 bool do_sort(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
     }
 
+    size_t i = 0;
+    q_cmp_t by = NULL;
+    if (argc == 2) {
+        while (i < sizeof(sort_modes) / sizeof(sort_modes[0]) &&
+               strcmp(argv[1], sort_modes[i].name))
+            i++;
+        if (i == sizeof(sort_modes) / sizeof(sort_modes[0])) {
+            size_t k = 0;
+            while (k < sizeof(sort_orders) / sizeof(sort_orders[0]) &&
+                   strcmp(argv[1], sort_orders[k].name))
+                k++;
+            if (k == sizeof(sort_orders) / sizeof(sort_orders[0])) {
+                report(1, "Unknown sort mode or order '%s'", argv[1]);
+                return false;
+            }
+            by = sort_orders[k].cmp;
+            i = 0;
+        }
+    }
+    q_sort_mode_t mode = sort_modes[i].mode;
+    q_cmp_t order = by != NULL ? by : sort_modes[i].order;
+
     if (!q)
         report(3, "Warning: Calling sort on null queue");
     error_check();
@@ -548,21 +1173,35 @@ bool do_sort(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_sort(q);
+    /* The one scratch block the sort declares it needs */
+    set_noallocate_budget(by != NULL ? 0 : q_sort_scratch(q, mode));
+    if (exception_setup(true)) {
+        if (by != NULL)
+            q_sort_by(q, by);
+        else if (sort_modes[i].parallel)
+            q_sort_parallel(q, sort_threads);
+        else
+            q_sort_mode(q, mode);
+    }
     exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
     if (q) {
-        for (list_ele_t *e = q->head; e && --cnt; e = e->next) {
+        q_iter_t it;
+        q_iter_init(q, &it);
+        char *prev = q_iter_next(q, &it);
+        while (prev && --cnt) {
+            char *cur = q_iter_next(q, &it);
+            if (!cur)
+                break;
             /* Ensure each element in ascending order */
-            /* FIXME: add an option to specify sorting order */
-            if (strcasecmp(e->value, e->next->value) > 0) {
+            if (order(prev, cur) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
+            prev = cur;
         }
     }
 
@@ -570,6 +1209,638 @@ bool do_sort(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/*
+ * Sort n random strings with 1, 2, ... option threads threads, the same
+ * strings each time, and report how much faster than with one thread.
+ * A first round goes untimed, since it is the only one whose elements
+ * come from fresh memory rather than from blocks freed by a sort.
+ */
+static bool do_sortscale(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int n = 1000000;
+    if (argc == 2 && (!get_int(argv[1], &n) || n < 0)) {
+        report(1, "Invalid number of strings '%s'", argv[1]);
+        return false;
+    }
+
+    q_kind_t kind = pool_mode ? Q_POOL : Q_PLAIN;
+    unsigned int seed = rand();
+    double base = 0;
+    bool ok = true;
+    for (int t = 0; ok && t <= sort_threads && t <= Q_SORT_MAX_THREADS; t++) {
+        queue_t *sq = q_new_kind(kind);
+        if (sq == NULL) {
+            report(1, "ERROR: Could not allocate queue");
+            return false;
+        }
+        char buf[MAX_RANDSTR_LEN];
+        srand(seed);
+        for (int i = 0; ok && i < n; i++) {
+            fill_rand_string(buf, sizeof(buf));
+            ok = q_insert_head(sq, buf);
+        }
+        if (!ok) {
+            report(1, "ERROR: Could not insert %d strings", n);
+            q_free(sq);
+            return false;
+        }
+
+        double elapsed;
+        init_time(&elapsed);
+        if (exception_setup(false))
+            q_sort_parallel(sq, t);
+        exception_cancel();
+        elapsed = delta_time(&elapsed);
+        ok = !error_check();
+
+        q_iter_t it;
+        q_iter_init(sq, &it);
+        char *prev = q_iter_next(sq, &it), *cur;
+        while (ok && (cur = q_iter_next(sq, &it)) != NULL) {
+            if (strnatcmp(prev, cur) > 0) {
+                report(1, "ERROR: Not sorted in ascending order");
+                ok = false;
+            }
+            prev = cur;
+        }
+        if (n > big_queue_size)
+            set_cautious_mode(false);
+        q_free(sq);
+        set_cautious_mode(true);
+
+        if (t <= 1)
+            base = elapsed;
+        if (ok && t > 0)
+            report(1, "%2d thread(s): %.3f s, speedup %.2f", t, elapsed,
+                   elapsed > 0 ? base / elapsed : 0);
+    }
+    return ok;
+}
+
+/* Most producer threads, and most consumer threads, of stress */
+#define STRESS_MAX_THREADS 32
+
+/* Milliseconds pipeline consumers wait before checking for the end */
+#define PIPELINE_POLL_MS 1
+
+/* State shared by the threads of the stress and pipeline commands */
+static struct {
+    unsigned int producers;
+    int n;                   /* Strings inserted by each producer */
+    bool serialize;          /* Threads may not share the queue, lock first */
+    bool blocking;           /* Wait while the queue is full or empty */
+    bool done;               /* Every producer has finished */
+    pthread_mutex_t lock;
+    unsigned char *inserted; /* Per string, whether it got inserted */
+    unsigned char *removed;  /* Per string, how many times it was removed */
+    int64_t *stamp;          /* Per string, nanoseconds when insert began */
+    int64_t *latency;        /* Per string, nanoseconds until removed */
+    long disorder; /* Strings a consumer got ahead of older ones */
+    long foreign;  /* Removed strings no producer inserted */
+} stress = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * A serialized queue is not thread-safe, so it has nothing to wait on
+ * either, and the lock must not be held while waiting anyway.
+ */
+static bool stress_insert(char *s)
+{
+    if (!stress.serialize)
+        return stress.blocking ? q_insert_tail_wait(q, s, -1)
+                               : q_insert_tail(q, s);
+    pthread_mutex_lock(&stress.lock);
+    bool ok = q_insert_tail(q, s);
+    pthread_mutex_unlock(&stress.lock);
+    return ok;
+}
+
+static bool stress_remove(char *buf, size_t bufsize)
+{
+    if (!stress.serialize)
+        return stress.blocking
+                   ? q_remove_head_wait(q, buf, bufsize, PIPELINE_POLL_MS)
+                   : q_remove_head(q, buf, bufsize);
+    pthread_mutex_lock(&stress.lock);
+    bool ok = q_remove_head(q, buf, bufsize);
+    pthread_mutex_unlock(&stress.lock);
+    return ok;
+}
+
+/* Producer id inserts strings "p<id>-0", "p<id>-1", ... in this order */
+static void *stress_produce(void *arg)
+{
+    unsigned int id = (uintptr_t) arg;
+    char buf[32];
+    for (int i = 0; i < stress.n; i++) {
+        size_t k = (size_t) id * stress.n + i;
+        snprintf(buf, sizeof(buf), "p%u-%d", id, i);
+        stress.stamp[k] = now_ns();
+        if (stress_insert(buf))
+            stress.inserted[k] = 1;
+    }
+    return NULL;
+}
+
+/*
+ * Remove strings until the queue is found empty after every producer
+ * finished.  Since the queue is FIFO, the strings of each producer must
+ * come out in the order they went in.
+ */
+static void *stress_consume(void *arg)
+{
+    int last[STRESS_MAX_THREADS];
+    for (unsigned int p = 0; p < STRESS_MAX_THREADS; p++)
+        last[p] = -1;
+    char buf[32];
+    while (true) {
+        bool done = __atomic_load_n(&stress.done, __ATOMIC_ACQUIRE);
+        if (!stress_remove(buf, sizeof(buf))) {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+        int64_t removed_at = now_ns();
+        unsigned int p;
+        int i;
+        if (sscanf(buf, "p%u-%d", &p, &i) != 2 || p >= stress.producers ||
+            i < 0 || i >= stress.n) {
+            __atomic_fetch_add(&stress.foreign, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        size_t k = (size_t) p * stress.n + i;
+        __atomic_fetch_add(&stress.removed[k], 1, __ATOMIC_RELAXED);
+        stress.latency[k] = removed_at - stress.stamp[k];
+        if (i <= last[p])
+            __atomic_fetch_add(&stress.disorder, 1, __ATOMIC_RELAXED);
+        last[p] = i;
+    }
+    return NULL;
+}
+
+/*
+ * Run the threads of the stress command, with signals left to the main
+ * thread.  Threads that could not be started run in the main thread
+ * instead, producers before and consumers after the others finished.
+ */
+static void stress_run(unsigned int producers, unsigned int consumers)
+{
+    pthread_t tid[2 * STRESS_MAX_THREADS];
+    bool started[2 * STRESS_MAX_THREADS];
+    unsigned int total = producers + consumers;
+    sigset_t all, old;
+    sigfillset(&all);
+    set_threaded_mode(true);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (unsigned int t = 0; t < total; t++) {
+        void *(*fn)(void *) = t < consumers ? stress_consume : stress_produce;
+        void *arg = (void *) (uintptr_t) (t < consumers ? t : t - consumers);
+        started[t] = pthread_create(&tid[t], NULL, fn, arg) == 0;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    for (unsigned int t = consumers; t < total; t++) {
+        if (started[t])
+            pthread_join(tid[t], NULL);
+        else
+            stress_produce((void *) (uintptr_t) (t - consumers));
+    }
+    __atomic_store_n(&stress.done, true, __ATOMIC_RELEASE);
+    for (unsigned int t = 0; t < consumers; t++) {
+        if (started[t])
+            pthread_join(tid[t], NULL);
+        else
+            stress_consume(NULL);
+    }
+    set_threaded_mode(false);
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Report percentiles of the m latencies in v, which get sorted, each
+ * divided by scale to get the given unit, under the given label.
+ */
+static void report_percentiles(int64_t *v,
+                               size_t m,
+                               const char *label,
+                               const char *unit,
+                               double scale)
+{
+    if (m == 0)
+        return;
+    qsort(v, m, sizeof(int64_t), cmp_int64);
+    static const double pct[] = {50, 90, 99, 99.9};
+    char buf[160];
+    int len = snprintf(buf, sizeof(buf), "%s (%s):", label, unit);
+    for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); i++) {
+        size_t k = (size_t) (pct[i] / 100 * (m - 1));
+        len += snprintf(buf + len, sizeof(buf) - len, " p%g %.1f,", pct[i],
+                        v[k] / scale);
+    }
+    report(1, "%s max %.1f", buf, v[m - 1] / scale);
+}
+
+/*
+ * Report percentiles of the latencies of the cnt strings removed once.
+ * They run from when the producer started inserting a string, so they
+ * include any wait for room in a full queue as well as the time queued.
+ */
+static void report_latency(size_t cnt)
+{
+    size_t m = 0;
+    for (size_t k = 0; k < cnt; k++)
+        if (stress.inserted[k] && stress.removed[k] == 1)
+            stress.latency[m++] = stress.latency[k];
+    report_percentiles(stress.latency, m, "End-to-end latency", "us", 1e3);
+}
+
+/*
+ * Common part of stress and pipeline, which differ in whether threads
+ * wait while the queue is full or empty, and in what they report.
+ */
+static bool stress_command(int argc, char *argv[], bool pipeline)
+{
+    if (argc != 3 && argc != 4) {
+        report(1, "%s takes 2-3 arguments", argv[0]);
+        return false;
+    }
+
+    int producers, consumers, n = 100000;
+    if (!get_int(argv[1], &producers) || producers < 1 ||
+        producers > STRESS_MAX_THREADS) {
+        report(1, "Invalid number of producers '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &consumers) || consumers < 1 ||
+        consumers > STRESS_MAX_THREADS) {
+        report(1, "Invalid number of consumers '%s'", argv[2]);
+        return false;
+    }
+    if (argc == 4 && (!get_int(argv[3], &n) || n < 0)) {
+        report(1, "Invalid number of strings '%s'", argv[3]);
+        return false;
+    }
+    if (q == NULL || q_size(q) != 0) {
+        report(1, "ERROR: %s needs an empty queue", argv[0]);
+        return false;
+    }
+    error_check();
+
+    size_t cnt = (size_t) producers * n;
+    stress.producers = producers;
+    stress.n = n;
+    stress.serialize =
+        (stress_lock && !pipeline) ||
+        !(q_thread_safe(q) ||
+          (q_spsc_safe(q) && producers == 1 && consumers == 1));
+    stress.blocking = pipeline;
+    stress.done = false;
+    stress.disorder = 0;
+    stress.foreign = 0;
+    stress.inserted = calloc(cnt + 1, 1);
+    stress.removed = calloc(cnt + 1, 1);
+    stress.stamp = calloc(cnt + 1, sizeof(int64_t));
+    stress.latency = calloc(cnt + 1, sizeof(int64_t));
+    bool ok = stress.inserted != NULL && stress.removed != NULL &&
+              stress.stamp != NULL && stress.latency != NULL;
+    if (!ok)
+        report(1, "ERROR: Could not allocate %zu strings", cnt);
+
+    double elapsed;
+    if (ok) {
+        set_cautious_mode(false);
+        init_time(&elapsed);
+        stress_run(producers, consumers);
+        elapsed = delta_time(&elapsed);
+        set_cautious_mode(true);
+        ok = !error_check();
+    }
+
+    size_t inserted = 0, lost = 0, again = 0;
+    for (size_t i = 0; ok && i < cnt; i++) {
+        inserted += stress.inserted[i];
+        if (stress.removed[i] < stress.inserted[i])
+            lost++;
+        else if (stress.removed[i] > stress.inserted[i])
+            again++;
+    }
+    if (ok) {
+        report(1,
+               "%d producer(s), %d consumer(s)%s: %zu strings in %.3f s, "
+               "%.2f Mops/s",
+               producers, consumers, stress.serialize ? " behind a lock" : "",
+               inserted, elapsed,
+               elapsed > 0 ? 2 * inserted / elapsed / 1e6 : 0);
+        if (pipeline)
+            report_latency(cnt);
+    }
+    if (lost > 0 || again > 0 || stress.foreign > 0) {
+        report(1,
+               "ERROR: %zu strings never removed, %zu removed too often, "
+               "%ld never inserted",
+               lost, again, stress.foreign);
+        ok = false;
+    }
+    if (stress.disorder > 0) {
+        report(1, "ERROR: %ld strings removed ahead of older ones",
+               stress.disorder);
+        ok = false;
+    }
+    if (q_size(q) != 0) {
+        report(1, "ERROR: Queue still holds %d strings", q_size(q));
+        ok = false;
+    }
+    if (ok)
+        report(1, "Conservation: every string inserted was removed once");
+    free(stress.inserted);
+    free(stress.removed);
+    free(stress.stamp);
+    free(stress.latency);
+    return ok;
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    return stress_command(argc, argv, false);
+}
+
+static bool do_pipeline(int argc, char *argv[])
+{
+    return stress_command(argc, argv, true);
+}
+
+/* Most strings handoff sends one at a time to measure latency */
+#define HANDOFF_TIMED 10000
+
+/* Failed polls of a full or empty queue before yielding the processor */
+#define HANDOFF_SPIN 64
+
+/* State shared by the two threads of the handoff command */
+static struct {
+    int n;         /* Strings streamed */
+    int timed;     /* Strings then sent one at a time */
+    int64_t *sent; /* Per timed string, cycle count before inserting it */
+    int64_t *took; /* Per timed string, cycles until it was removed */
+    int acked;     /* Timed strings removed so far */
+    long disorder; /* Strings removed out of order, or never inserted */
+    int64_t streamed_ns, streamed_cycles; /* When the last streamed came */
+} handoff;
+
+/* Wait a little after the *polls-th failed attempt in a row */
+static void handoff_backoff(unsigned int *polls)
+{
+    if (++*polls >= HANDOFF_SPIN) {
+        *polls = 0;
+        sched_yield();
+    }
+}
+
+/*
+ * Producer of handoff: insert "h0", "h1", ... retrying while the queue is
+ * full, then send the timed strings one by one, each once the consumer
+ * has removed the one before.
+ */
+static void *handoff_produce(void *arg)
+{
+    char buf[32];
+    unsigned int polls = 0;
+    for (int i = 0; i < handoff.n; i++) {
+        snprintf(buf, sizeof(buf), "h%d", i);
+        while (!stress_insert(buf))
+            handoff_backoff(&polls);
+    }
+    for (int i = 0; i < handoff.timed; i++) {
+        snprintf(buf, sizeof(buf), "h%d", handoff.n + i);
+        while (__atomic_load_n(&handoff.acked, __ATOMIC_ACQUIRE) < i)
+            handoff_backoff(&polls);
+        handoff.sent[i] = cpucycles();
+        while (!stress_insert(buf))
+            handoff_backoff(&polls);
+    }
+    return NULL;
+}
+
+/* Consumer of handoff: remove every string, checking they come in order */
+static void *handoff_consume(void *arg)
+{
+    char buf[32];
+    unsigned int polls = 0;
+    for (int i = 0; i < handoff.n + handoff.timed; i++) {
+        while (!stress_remove(buf, sizeof(buf)))
+            handoff_backoff(&polls);
+        int64_t now = cpucycles();
+        int k;
+        if (sscanf(buf, "h%d", &k) != 1 || k != i)
+            handoff.disorder++;
+        if (i == handoff.n - 1) {
+            handoff.streamed_ns = now_ns();
+            handoff.streamed_cycles = now;
+        }
+        if (i >= handoff.n) {
+            handoff.took[i - handoff.n] = now - handoff.sent[i - handoff.n];
+            __atomic_store_n(&handoff.acked, i - handoff.n + 1,
+                             __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static bool do_handoff(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    int n = 1000000;
+    if (argc == 2 && (!get_int(argv[1], &n) || n < 0)) {
+        report(1, "Invalid number of strings '%s'", argv[1]);
+        return false;
+    }
+    if (q == NULL || q_size(q) != 0) {
+        report(1, "ERROR: %s needs an empty queue", argv[0]);
+        return false;
+    }
+    error_check();
+
+    stress.serialize = stress_lock || !q_spsc_safe(q);
+    stress.blocking = false;
+    handoff.n = n;
+    handoff.timed = n < HANDOFF_TIMED ? n : HANDOFF_TIMED;
+    handoff.acked = 0;
+    handoff.disorder = 0;
+    handoff.sent = calloc(handoff.timed + 1, sizeof(int64_t));
+    handoff.took = calloc(handoff.timed + 1, sizeof(int64_t));
+    if (handoff.sent == NULL || handoff.took == NULL) {
+        report(1, "ERROR: Could not allocate %d timestamps", handoff.timed);
+        free(handoff.sent);
+        free(handoff.took);
+        return false;
+    }
+
+    /* Both sides run in threads of their own, with signals left to us */
+    pthread_t consumer, producer;
+    sigset_t all, old;
+    sigfillset(&all);
+    set_cautious_mode(false);
+    set_threaded_mode(true);
+    int64_t start_ns = now_ns(), start_cycles = cpucycles();
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    bool consuming =
+        pthread_create(&consumer, NULL, handoff_consume, NULL) == 0;
+    bool producing = consuming && pthread_create(&producer, NULL,
+                                                 handoff_produce, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    /* Without a consumer, the producer would wait for it forever */
+    if (consuming && !producing)
+        handoff_produce(NULL);
+    if (producing)
+        pthread_join(producer, NULL);
+    if (consuming)
+        pthread_join(consumer, NULL);
+    set_threaded_mode(false);
+    set_cautious_mode(true);
+    bool ok = !error_check();
+    if (!consuming) {
+        report(1, "ERROR: Could not start the consumer thread");
+        ok = false;
+    }
+
+    if (ok && n > 0) {
+        double elapsed = (handoff.streamed_ns - start_ns) / 1e9;
+        report(1,
+               "handoff%s: %d strings in %.3f s, %.2f Mops/s, %.0f cycles "
+               "per string",
+               stress.serialize ? " behind a lock" : "", n, elapsed,
+               elapsed > 0 ? 2 * n / elapsed / 1e6 : 0,
+               (double) (handoff.streamed_cycles - start_cycles) / n);
+        report_percentiles(handoff.took, handoff.timed, "Latency", "cycles",
+                           1);
+    }
+    if (handoff.disorder > 0) {
+        report(1, "ERROR: %ld strings removed out of order", handoff.disorder);
+        ok = false;
+    }
+    if (q_size(q) != 0) {
+        report(1, "ERROR: Queue still holds %d strings", q_size(q));
+        ok = false;
+    }
+    free(handoff.sent);
+    free(handoff.took);
+    return ok;
+}
+
+/* Characters of the strings generated by natcheck */
+static const char nat_charset[] = "0000123459  \taAzZ-\x80\xff";
+
+/* Longest string generated by natcheck, and room for its transform */
+#define NAT_STR_LEN 40
+#define NAT_XFRM_LEN (3 * NAT_STR_LEN + 2)
+
+static void fill_nat_string(char *buf)
+{
+    size_t len = rand() % NAT_STR_LEN;
+    for (size_t n = 0; n < len; n++)
+        buf[n] = nat_charset[rand() % (sizeof nat_charset - 1)];
+    buf[len] = '\0';
+}
+
+static inline int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+/*
+ * Check that the transforms of strings a and b, and prefixes of them,
+ * order a and b as strnatcmp does.
+ */
+static bool natcheck_pair(const char *a, const char *b)
+{
+    unsigned char xa[NAT_XFRM_LEN], xb[NAT_XFRM_LEN];
+    size_t la = strnatxfrm(xa, a, sizeof(xa));
+    size_t lb = strnatxfrm(xb, b, sizeof(xb));
+    int expect = sign(strnatcmp(a, b));
+    int got = sign(memcmp(xa, xb, la < lb ? la : lb));
+    if (got != expect) {
+        report(1, "ERROR: strnatxfrm orders '%s' and '%s' as %d, not %d", a,
+               b, got, expect);
+        return false;
+    }
+    if (got == 0 && la != lb) {
+        report(1, "ERROR: Transform of '%s' is a prefix of that of '%s'",
+               la < lb ? a : b, la < lb ? b : a);
+        return false;
+    }
+
+    /* Prefixes of the transforms may tie, but never disagree */
+    size_t k = rand() % 12;
+    unsigned char pa[12], pb[12];
+    la = strnatxfrm(pa, a, k);
+    lb = strnatxfrm(pb, b, k);
+    if (la > k)
+        la = k;
+    if (lb > k)
+        lb = k;
+    int partial = sign(memcmp(pa, pb, la < lb ? la : lb));
+    if (partial != 0 && partial != expect) {
+        report(1, "ERROR: %zu-byte strnatxfrm prefixes misorder '%s' and '%s'",
+               k, a, b);
+        return false;
+    }
+    return true;
+}
+
+static bool do_natcheck(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 100000;
+    if (argc == 2 && (!get_int(argv[1], &reps) || reps < 0)) {
+        report(1, "Invalid number of pairs '%s'", argv[1]);
+        return false;
+    }
+
+    char a[NAT_STR_LEN], b[NAT_STR_LEN];
+    bool ok = true;
+    for (int r = 0; ok && r < reps; r++) {
+        fill_nat_string(a);
+        if (rand() % 3 == 0) {
+            /* Share a prefix, so that the interesting bytes get compared */
+            size_t len = rand() % (strlen(a) + 1);
+            size_t extra = rand() % (NAT_STR_LEN - len);
+            memcpy(b, a, len);
+            for (size_t n = len; n < len + extra; n++)
+                b[n] = nat_charset[rand() % (sizeof nat_charset - 1)];
+            b[len + extra] = '\0';
+        } else {
+            fill_nat_string(b);
+        }
+        ok = natcheck_pair(a, b) && natcheck_pair(b, a);
+    }
+    if (ok)
+        report(2, "strnatxfrm agrees with strnatcmp on %d pairs", reps);
+    return ok;
+}
+
 static bool show_queue(int vlevel)
 {
     bool ok = true;
@@ -583,12 +1854,15 @@ static bool show_queue(int vlevel)
     }
 
     report_noreturn(vlevel, "q = [");
-    list_ele_t *e = q->head;
+    q_iter_t it;
+    char *e = NULL;
     if (exception_setup(true)) {
+        q_iter_init(q, &it);
+        e = q_iter_next(q, &it);
         while (ok && e && cnt < qcnt) {
             if (cnt < big_queue_size)
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
-            e = e->next;
+                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e);
+            e = q_iter_next(q, &it);
             cnt++;
             ok = ok && !error_check();
         }
@@ -626,6 +1900,19 @@ static bool do_show(int argc, char *argv[])
     return show_queue(0);
 }
 
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    report(1, "Allocated %zu bytes in %zu blocks, peak %zu bytes, %zu strings "
+           "interned",
+           allocation_bytes(), allocation_check(), allocation_peak(true),
+           intern_count());
+    return true;
+}
+
 /* Signal handlers */
 static void sigsegvhandler(int sig)
 {
@@ -652,11 +1939,13 @@ static void queue_init()
 static bool queue_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (qcnt > big_queue_size)
+    if (qcnt + side_cnt > big_queue_size)
         set_cautious_mode(false);
 
-    if (exception_setup(true))
+    if (exception_setup(true)) {
+        q_free(side);
         q_free(q);
+    }
     exception_cancel();
     set_cautious_mode(true);
 
@@ -1,16 +1,456 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h> /* strcasecmp */
 
+#include "backend.h"
 #include "harness.h"
+#include "intern.h"
 #include "queue.h"
 #include "strnatcmp.h"
 
+/*
+ * Node pool for Q_POOL queues.
+ * List elements are carved out of slabs taken from malloc in big chunks.
+ * Removed elements are kept on an intrusive free list, linked through
+ * their next field, and handed out again before any fresh slot is used.
+ * Strings too long to be stored inline still get a malloc of their own,
+ * unless they are interned.
+ */
+
+/* Number of slots carved out of each slab */
+#define POOL_SLAB_SLOTS 1024
+
+typedef struct SLAB {
+    struct SLAB *next;
+    list_ele_t slots[];
+} slab_t;
+
+struct POOL {
+    slab_t *slabs;           /* All slabs owned by the pool */
+    slab_t *slabs_tail;      /* Oldest slab */
+    list_ele_t *bump;        /* Next never-used slot of the newest slab */
+    list_ele_t *bump_end;    /* End of the newest slab */
+    list_ele_t *free_list;   /* Recycled slots */
+    list_ele_t *free_tail;   /* Last recycled slot, if free_list is set */
+    unsigned int heap_count; /* Live elements with a string not inline */
+    unsigned int refs;       /* Queues drawing from the pool */
+};
+
+/* Take one slot from the pool, return NULL if could not allocate space */
+static list_ele_t *pool_alloc(struct POOL *pool)
+{
+    list_ele_t *e = pool->free_list;
+    if (e != NULL) {
+        pool->free_list = e->next;
+        return e;
+    }
+    if (pool->bump == pool->bump_end) {
+        slab_t *slab =
+            malloc(sizeof(slab_t) + sizeof(list_ele_t) * POOL_SLAB_SLOTS);
+        if (slab == NULL)
+            return NULL;
+        if (pool->slabs == NULL)
+            pool->slabs_tail = slab;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->bump = slab->slots;
+        pool->bump_end = slab->slots + POOL_SLAB_SLOTS;
+    }
+    return pool->bump++;
+}
+
+/* Return one slot to the pool for recycling */
+static inline void pool_release(struct POOL *pool, list_ele_t *e)
+{
+    if (pool->free_list == NULL)
+        pool->free_tail = e;
+    e->next = pool->free_list;
+    pool->free_list = e;
+}
+
+/*
+ * Drop one queue from the users of the pool.  Once the last one is gone,
+ * give all slabs back, releasing every pooled element at once.
+ */
+static void pool_destroy(struct POOL *pool)
+{
+    if (pool == NULL || --pool->refs > 0)
+        return;
+    slab_t *slab = pool->slabs;
+    while (slab != NULL) {
+        slab_t *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(pool);
+}
+
+/*
+ * Hand all slabs and recycled slots of pool from over to pool into, and
+ * free from.  The newest slab of into stays in front, so the never-used
+ * slots left in the newest slab of from are lost until both go away.
+ */
+static void pool_fold(struct POOL *into, struct POOL *from)
+{
+    if (into->slabs == NULL) {
+        into->slabs = from->slabs;
+        into->slabs_tail = from->slabs_tail;
+        into->bump = from->bump;
+        into->bump_end = from->bump_end;
+    } else if (from->slabs != NULL) {
+        if (into->slabs->next == NULL)
+            into->slabs_tail = from->slabs_tail;
+        from->slabs_tail->next = into->slabs->next;
+        into->slabs->next = from->slabs;
+    }
+    if (from->free_list != NULL) {
+        if (into->free_list == NULL)
+            into->free_tail = from->free_tail;
+        from->free_tail->next = into->free_list;
+        into->free_list = from->free_list;
+    }
+    into->heap_count += from->heap_count;
+    into->refs += from->refs;
+    free(from);
+}
+
+/*
+ * Bump arena for Q_ARENA queues.
+ * Elements and their long strings are bump-allocated, one right after
+ * the other, from large chunks and
+ * never freed one by one: removed elements are abandoned in place and
+ * the whole arena is given back by q_free.  Once abandoned space
+ * outweighs live space, the live elements are copied into fresh chunks
+ * so that a long-running queue does not keep growing.
+ */
+
+/* Usable bytes of a regular arena chunk */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Compact once dead bytes exceed live bytes times this ratio */
+#define ARENA_COMPACT_RATIO 1
+
+typedef struct CHUNK {
+    struct CHUNK *next;
+    char data[];
+} chunk_t;
+
+struct ARENA {
+    chunk_t *chunks;      /* All chunks owned by the arena */
+    chunk_t *chunks_tail; /* Last chunk of the list */
+    char *bump;           /* Next free byte of the newest chunk */
+    char *bump_end;       /* End of the newest chunk */
+    size_t live_bytes;    /* Bytes held by elements still in the queue */
+    size_t dead_bytes;    /* Bytes held by removed elements */
+    unsigned int taken;   /* Elements handed out by q_take_head() */
+    unsigned int refs;    /* Queues drawing from the arena */
+};
+
+/* Bytes taken from the arena by an element with a string of s_lenth */
+static inline size_t arena_ele_size(size_t s_lenth)
+{
+    size_t align = sizeof(void *);
+    if (s_lenth < ELE_LOCAL_SIZE)
+        return sizeof(list_ele_t);
+    return sizeof(list_ele_t) + ((s_lenth + align) & ~(align - 1));
+}
+
+/* Bump-allocate size bytes, return NULL if could not allocate space */
+static void *arena_alloc(struct ARENA *arena, size_t size)
+{
+    if (size > ARENA_CHUNK_SIZE) {
+        // Too big for a regular chunk: give it a chunk of its own, kept
+        // behind the newest one so that bumping carries on undisturbed
+        chunk_t *big = malloc(sizeof(chunk_t) + size);
+        if (big == NULL)
+            return NULL;
+        if (arena->chunks == NULL) {
+            big->next = NULL;
+            arena->chunks = big;
+            arena->chunks_tail = big;
+        } else {
+            if (arena->chunks->next == NULL)
+                arena->chunks_tail = big;
+            big->next = arena->chunks->next;
+            arena->chunks->next = big;
+        }
+        arena->live_bytes += size;
+        return big->data;
+    }
+    if ((size_t)(arena->bump_end - arena->bump) < size) {
+        chunk_t *chunk = malloc(sizeof(chunk_t) + ARENA_CHUNK_SIZE);
+        if (chunk == NULL)
+            return NULL;
+        if (arena->chunks == NULL)
+            arena->chunks_tail = chunk;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->bump = chunk->data;
+        arena->bump_end = chunk->data + ARENA_CHUNK_SIZE;
+    }
+    void *p = arena->bump;
+    arena->bump += size;
+    arena->live_bytes += size;
+    return p;
+}
+
+/* Free a list of arena chunks */
+static void chunks_release(chunk_t *chunk)
+{
+    while (chunk != NULL) {
+        chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+/*
+ * Drop one queue from the users of the arena.  Once the last one is gone,
+ * give all chunks back, releasing every element at once.
+ */
+static void arena_destroy(struct ARENA *arena)
+{
+    if (arena == NULL || --arena->refs > 0)
+        return;
+    chunks_release(arena->chunks);
+    free(arena);
+}
+
+/*
+ * Hand all chunks of arena from over to arena into, and free from.  As
+ * with pool_fold(), bumping carries on in the newest chunk of into.
+ */
+static void arena_fold(struct ARENA *into, struct ARENA *from)
+{
+    if (into->chunks == NULL) {
+        into->chunks = from->chunks;
+        into->chunks_tail = from->chunks_tail;
+        into->bump = from->bump;
+        into->bump_end = from->bump_end;
+    } else if (from->chunks != NULL) {
+        if (into->chunks->next == NULL)
+            into->chunks_tail = from->chunks_tail;
+        from->chunks_tail->next = into->chunks->next;
+        into->chunks->next = from->chunks;
+    }
+    into->live_bytes += from->live_bytes;
+    into->dead_bytes += from->dead_bytes;
+    into->taken += from->taken;
+    into->refs += from->refs;
+    free(from);
+}
+
+/*
+ * Copy the live elements of arena-backed queue q into fresh chunks and
+ * drop the old ones, if enough space has been abandoned to be worth it.
+ * The queue is left untouched if the new chunks could not be allocated.
+ */
+static void arena_maybe_compact(queue_t *q)
+{
+    struct ARENA *old = q->arena;
+    // Taken elements must stay where they are until released, and so
+    // must the elements of other queues sharing the arena
+    if (old->taken > 0 || old->refs > 1 || old->dead_bytes < ARENA_CHUNK_SIZE ||
+        old->dead_bytes <= old->live_bytes * ARENA_COMPACT_RATIO)
+        return;
+
+    struct ARENA fresh = {0};
+    list_ele_t pseudo = {.next = NULL};
+    list_ele_t *prv = &pseudo;
+    for (list_ele_t *e = q->head; e != NULL; e = e->next) {
+        size_t size = arena_ele_size(list_ele_length(e));
+        list_ele_t *copy = arena_alloc(&fresh, size);
+        if (copy == NULL) {
+            chunks_release(fresh.chunks);
+            return;
+        }
+        memcpy(copy, e, sizeof(list_ele_t));
+        if (!list_ele_is_local(e)) {
+            copy->str.heap.ptr = (char *) (copy + 1);
+            memcpy(copy->str.heap.ptr, e->str.heap.ptr, e->str.heap.len + 1);
+        }
+        prv->next = copy;
+        prv = copy;
+    }
+    prv->next = NULL;
+
+    chunks_release(old->chunks);
+    fresh.refs = old->refs;
+    *old = fresh;
+    q->head = pseudo.next;
+    q->tail = q->head == NULL ? NULL : prv;
+}
+
+/*
+ * Copy string s of length s_lenth into list element e.
+ * Short strings are stored inline, longer ones go to buf, which must
+ * have room for s_lenth + 1 bytes.
+ */
+static void ele_store(list_ele_t *e, const char *s, size_t s_lenth, char *buf)
+{
+    if (buf == NULL) {
+        memcpy(e->str.local, s, s_lenth + 1);
+        e->str.local[ELE_LOCAL_SIZE - 1] = ELE_LOCAL_SIZE - 1 - s_lenth;
+    } else {
+        memcpy(buf, s, s_lenth + 1);
+        e->str.heap.ptr = buf;
+        e->str.heap.len = s_lenth;
+        e->str.local[ELE_LOCAL_SIZE - 1] = (char) ELE_HEAP_TAG;
+    }
+}
+
+/* Make list element e refer to interned string s of length s_lenth */
+static inline void ele_share(list_ele_t *e, char *s, size_t s_lenth)
+{
+    e->str.heap.ptr = s;
+    e->str.heap.len = s_lenth;
+    e->str.local[ELE_LOCAL_SIZE - 1] = (char) ELE_INTERN_TAG;
+}
+
+/*
+ * Space for the string of length s_lenth of a new element of queue q,
+ * not stored inline: a block to copy it into, or its interned copy.
+ * Return NULL if could not allocate space.
+ */
+static inline char *ele_string(queue_t *q, const char *s, size_t s_lenth)
+{
+    return q->intern ? intern_get(s, s_lenth) : malloc(s_lenth + 1);
+}
+
+/* Give back the string of list element e, if not stored inline */
+static inline void ele_string_release(list_ele_t *e)
+{
+    if (list_ele_is_interned(e))
+        intern_put(e->str.heap.ptr);
+    else if (!list_ele_is_local(e))
+        free(e->str.heap.ptr);
+}
+
+/*
+ * Allocate a list element of queue q holding a copy of string s, whose
+ * length is s_lenth.  Short strings are kept inside the element, so they
+ * need no allocation of their own, and long ones are shared rather than
+ * copied if the queue interns.
+ * Return NULL if could not allocate space.
+ */
+static list_ele_t *ele_new_len(queue_t *q, const char *s, size_t s_lenth)
+{
+    bool local = s_lenth < ELE_LOCAL_SIZE;
+    list_ele_t *newh;
+    char *buf = NULL;
+    switch (q->kind) {
+    case Q_POOL:
+        newh = pool_alloc(q->pool);
+        if (newh == NULL || local)
+            break;
+        buf = ele_string(q, s, s_lenth);
+        if (buf == NULL) {
+            pool_release(q->pool, newh);
+            return NULL;
+        }
+        q->pool->heap_count += 1;
+        break;
+    case Q_ARENA:
+        newh = arena_alloc(q->arena, arena_ele_size(s_lenth));
+        if (newh != NULL && !local)
+            buf = (char *) (newh + 1);
+        break;
+    default:
+        newh = malloc(sizeof(list_ele_t));
+        if (newh == NULL || local)
+            break;
+        buf = ele_string(q, s, s_lenth);
+        if (buf == NULL) {
+            free(newh);
+            return NULL;
+        }
+        break;
+    }
+    if (newh == NULL)
+        return NULL;
+    if (q->intern && buf != NULL)
+        ele_share(newh, buf, s_lenth);
+    else
+        ele_store(newh, s, s_lenth, buf);
+    return newh;
+}
+
+/*
+ * Allocate a list element of queue q holding a copy of string s.
+ * Return NULL if could not allocate space.
+ */
+static inline list_ele_t *ele_new(queue_t *q, const char *s)
+{
+    return ele_new_len(q, s, strlen(s));
+}
+
+/* Release list element e of queue q, string included */
+static void ele_release(queue_t *q, list_ele_t *e)
+{
+    switch (q->kind) {
+    case Q_POOL:
+        if (!list_ele_is_local(e)) {
+            q->pool->heap_count -= 1;
+            ele_string_release(e);
+        }
+        pool_release(q->pool, e);
+        break;
+    case Q_ARENA: {
+        // Abandon the element, its space is reclaimed by compaction
+        // or when the whole arena goes away
+        size_t size = arena_ele_size(list_ele_length(e));
+        q->arena->live_bytes -= size;
+        q->arena->dead_bytes += size;
+        break;
+    }
+    default:
+        ele_string_release(e);
+        free(e);
+        break;
+    }
+}
+
 /*
  * Create empty queue.
  * Return NULL if could not allocate space.
  */
 queue_t *q_new()
+{
+    return q_new_kind(Q_PLAIN);
+}
+
+/* Backend of a queue variant, NULL for the list-based ones */
+static const struct BACKEND *kind_backend(q_kind_t kind)
+{
+    switch (kind) {
+    case Q_UNROLLED:
+        return &unrolled_backend;
+    case Q_RING:
+        return &ring_backend;
+    case Q_LOCKFREE:
+        return &lockfree_backend;
+    case Q_TWOLOCK:
+        return &twolock_backend;
+    case Q_BOUNDED:
+        return &bounded_backend;
+    case Q_SPSC:
+        return &spsc_backend;
+    case Q_COMBINING:
+        return &combining_backend;
+    case Q_DEQUE:
+        return &deque_backend;
+    default:
+        return NULL;
+    }
+}
+
+queue_t *queue_create(q_kind_t kind, unsigned int capacity)
 {
     queue_t *q = malloc(sizeof(queue_t));
     // If nothing return by malloc, just return NULL
@@ -21,10 +461,79 @@ queue_t *q_new()
     q->head = NULL;
     q->tail = NULL;
     q->size = 0;
-    printf("INFO: q new success\n");
+    q->capacity = kind == Q_BOUNDED || kind == Q_SPSC ? capacity : 0;
+    q->kind = kind;
+    q->intern = false;
+    q->pool = NULL;
+    q->arena = NULL;
+    q->backend = kind_backend(kind);
+    q->impl = NULL;
+    if (q->backend != NULL) {
+        if (!q->backend->init(q)) {
+            printf("ERROR: q_new() failed\n");
+            free(q);
+            return NULL;
+        }
+    } else if (kind == Q_POOL) {
+        q->pool = malloc(sizeof(struct POOL));
+        if (q->pool == NULL) {
+            printf("ERROR: q_new() failed\n");
+            free(q);
+            return NULL;
+        }
+        memset(q->pool, 0, sizeof(struct POOL));
+        q->pool->refs = 1;
+    } else if (kind == Q_ARENA) {
+        q->arena = malloc(sizeof(struct ARENA));
+        if (q->arena == NULL) {
+            printf("ERROR: q_new() failed\n");
+            free(q);
+            return NULL;
+        }
+        memset(q->arena, 0, sizeof(struct ARENA));
+        q->arena->refs = 1;
+    }
+    return q;
+}
+
+/* Create a queue as queue_create() does, and report its creation */
+static queue_t *queue_new(q_kind_t kind, unsigned int capacity)
+{
+    queue_t *q = queue_create(kind, capacity);
+    if (q != NULL)
+        printf("INFO: q new success\n");
     return q;
 }
 
+/*
+ * Create empty queue of the given variant.
+ * Return NULL if could not allocate space.
+ */
+queue_t *q_new_kind(q_kind_t kind)
+{
+    return queue_new(kind, Q_BOUNDED_CAPACITY);
+}
+
+queue_t *q_new_bounded(unsigned int capacity)
+{
+    if (capacity == 0)
+        return NULL;
+    return queue_new(Q_BOUNDED, capacity);
+}
+
+queue_t *q_new_spsc(unsigned int capacity)
+{
+    if (capacity == 0 || capacity > Q_SPSC_MAX_CAPACITY)
+        return NULL;
+    return queue_new(Q_SPSC, capacity);
+}
+
+void q_set_intern(queue_t *q, bool intern)
+{
+    if (q != NULL && (q->kind == Q_PLAIN || q->kind == Q_POOL))
+        q->intern = intern;
+}
+
 /* Free all storage used by queue */
 void q_free(queue_t *q)
 {
@@ -32,16 +541,27 @@ void q_free(queue_t *q)
     if (q == NULL) {
         return;
     }
+    if (q->backend != NULL) {
+        q->backend->destroy(q);
+        free(q);
+        return;
+    }
 
     list_ele_t *current_ptr = q->head;
     list_ele_t *next = NULL;
+    // Pooled and arena elements go away with their slabs or chunks, so
+    // only walk the list if some strings were allocated on their own, or
+    // if the elements must be given back to an allocator that stays
+    if ((q->pool != NULL && q->pool->heap_count == 0 && q->pool->refs == 1) ||
+        (q->arena != NULL && q->arena->refs == 1))
+        current_ptr = NULL;
     while (current_ptr != NULL) {
         next = current_ptr->next;
-        // Free the memory used by string and list elements
-        free(current_ptr->value);
-        free(current_ptr);
+        ele_release(q, current_ptr);
         current_ptr = next;
     }
+    pool_destroy(q->pool);
+    arena_destroy(q->arena);
     free(q);
 }
 
@@ -59,23 +579,13 @@ bool q_insert_head(queue_t *q, char *s)
         printf("ERROR: Insert head to a NULL queue\n");
         return false;
     }
-    list_ele_t *newh = malloc(sizeof(list_ele_t));
+    if (q->backend != NULL)
+        return q->backend->insert_head(q, s);
+    list_ele_t *newh = ele_new(q, s);
     if (newh == NULL) {
-        // If queue is allocated at this time
         printf("ERROR: allocate newh fail\n");
         return false;
     }
-    unsigned int s_lenth = strlen(s);
-    newh->value = malloc(sizeof(char) * (s_lenth + 1));
-    // If fail to allocate space for value
-    if (newh->value == NULL) {
-        printf("ERROR: allocate newh->value fail\n");
-        free(newh);
-        // If queue is allocated at this time
-        return false;
-    }
-    strncpy(newh->value, s, s_lenth);
-    newh->value[s_lenth] = '\0';
     // Maintain the queue structure
     newh->next = q->head;
     q->head = newh;
@@ -98,20 +608,12 @@ bool q_insert_tail(queue_t *q, char *s)
         printf("ERROR: Insert tail to a NULL queue\n");
         return false;
     }
-    list_ele_t *newh;
-    newh = malloc(sizeof(list_ele_t));
+    if (q->backend != NULL)
+        return q->backend->insert_tail(q, s);
+    list_ele_t *newh = ele_new(q, s);
     if (newh == NULL) {
         return false;
     }
-    unsigned int s_lenth = strlen(s);
-    newh->value = malloc(sizeof(char) * (s_lenth + 1));
-    // If fail to allocate space for value
-    if (newh->value == NULL) {
-        free(newh);
-        return false;
-    }
-    strncpy(newh->value, s, s_lenth);
-    newh->value[s_lenth] = '\0';
     // Maintain the queue structure
     newh->next = NULL;
     if (q->size != 0)
@@ -123,6 +625,124 @@ bool q_insert_tail(queue_t *q, char *s)
     return true;
 }
 
+bool q_insert_tail_wait(queue_t *q, char *s, int timeout_ms)
+{
+    if (q != NULL && q->backend != NULL &&
+        q->backend->insert_tail_wait != NULL)
+        return q->backend->insert_tail_wait(q, s, timeout_ms);
+    return q_insert_tail(q, s);
+}
+
+/*
+ * Insert n strings through a backend insertion operation, after letting
+ * the backend reserve room for all of them at once.
+ * Return the number of strings inserted.
+ */
+static int backend_insert_many(queue_t *q,
+                               char **sv,
+                               int n,
+                               bool repeat,
+                               bool (*insert)(queue_t *q, char *s))
+{
+    if (q->backend->reserve != NULL)
+        q->backend->reserve(q, n);
+    int cnt = 0;
+    for (int i = 0; i < n; i++)
+        cnt += insert(q, repeat ? sv[0] : sv[i]);
+    return cnt;
+}
+
+/*
+ * Attempt to insert n elements at head of queue, with the same result as
+ * calling q_insert_head() on sv[0], sv[1], ... sv[n-1] in turn, or on
+ * sv[0] n times if repeat is true.
+ * The new elements are chained up first and spliced in at once.
+ * Return the number of elements inserted, which is less than n if some
+ * could not be allocated, and 0 if q is NULL.
+ */
+int q_insert_head_many(queue_t *q, char **sv, int n, bool repeat)
+{
+    if (q == NULL) {
+        printf("ERROR: Insert head to a NULL queue\n");
+        return 0;
+    }
+    if (q->backend != NULL)
+        return backend_insert_many(q, sv, n, repeat, q->backend->insert_head);
+    list_ele_t *first = NULL;
+    list_ele_t *last = NULL;
+    size_t s_lenth = repeat && n > 0 ? strlen(sv[0]) : 0;
+    int cnt = 0;
+    for (int i = 0; i < n; i++) {
+        list_ele_t *newh = repeat ? ele_new_len(q, sv[0], s_lenth)
+                                  : ele_new(q, sv[i]);
+        if (newh == NULL)
+            continue;
+        // Each new element goes in front of the previous one
+        newh->next = first;
+        first = newh;
+        if (last == NULL)
+            last = newh;
+        cnt++;
+    }
+    if (cnt < n)
+        printf("ERROR: allocate %d of %d elements fail\n", n - cnt, n);
+    if (cnt == 0)
+        return 0;
+    // Maintain the queue structure
+    last->next = q->head;
+    q->head = first;
+    if (q->size == 0)
+        q->tail = last;
+    q->size += cnt;
+    return cnt;
+}
+
+/*
+ * Attempt to insert n elements at tail of queue, with the same result as
+ * calling q_insert_tail() on sv[0], sv[1], ... sv[n-1] in turn, or on
+ * sv[0] n times if repeat is true.
+ * The new elements are chained up first and spliced in at once.
+ * Return the number of elements inserted, which is less than n if some
+ * could not be allocated, and 0 if q is NULL.
+ */
+int q_insert_tail_many(queue_t *q, char **sv, int n, bool repeat)
+{
+    if (q == NULL) {
+        printf("ERROR: Insert tail to a NULL queue\n");
+        return 0;
+    }
+    if (q->backend != NULL && q->backend->insert_tail_many != NULL)
+        return q->backend->insert_tail_many(q, sv, n, repeat);
+    if (q->backend != NULL)
+        return backend_insert_many(q, sv, n, repeat, q->backend->insert_tail);
+    list_ele_t pseudo = {.next = NULL};
+    list_ele_t *last = &pseudo;
+    size_t s_lenth = repeat && n > 0 ? strlen(sv[0]) : 0;
+    int cnt = 0;
+    for (int i = 0; i < n; i++) {
+        list_ele_t *newt = repeat ? ele_new_len(q, sv[0], s_lenth)
+                                  : ele_new(q, sv[i]);
+        if (newt == NULL)
+            continue;
+        last->next = newt;
+        last = newt;
+        cnt++;
+    }
+    if (cnt < n)
+        printf("ERROR: allocate %d of %d elements fail\n", n - cnt, n);
+    if (cnt == 0)
+        return 0;
+    // Maintain the queue structure
+    last->next = NULL;
+    if (q->size != 0)
+        q->tail->next = pseudo.next;
+    else
+        q->head = pseudo.next;
+    q->tail = last;
+    q->size += cnt;
+    return cnt;
+}
+
 /* Insert a existed list element into queue
  * Return true if success
  * Return false if insert element to a NULL queue
@@ -144,6 +764,20 @@ bool q_insert_element_to_tail(queue_t *q, list_ele_t *ele)
     return true;
 }
 
+/*
+ * Copy string s of length len to sp, as q_remove_head() does: at most
+ * bufsize-1 characters plus a null terminator.  No effect if sp is NULL.
+ */
+void copy_removed(char *sp, size_t bufsize, const char *s, size_t len)
+{
+    if (sp == NULL || bufsize == 0)
+        return;
+    if (len >= bufsize)
+        len = bufsize - 1;
+    memcpy(sp, s, len);
+    sp[len] = '\0';
+}
+
 /*
  * Attempt to remove element from head of queue.
  * Return true if successful.
@@ -154,20 +788,13 @@ bool q_insert_element_to_tail(queue_t *q, list_ele_t *ele)
  */
 bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
 {
+    if (q != NULL && q->backend != NULL)
+        return q->backend->remove_head(q, sp, bufsize);
     // NULL queue case and empty queue case
     if (q == NULL || q->head == NULL)
         return false;
-    unsigned int s_lenth = strlen(q->head->value);
-    if (s_lenth < bufsize) {
-        strncpy(sp, q->head->value, s_lenth);
-        sp[s_lenth] = '\0';
-    } else {
-        if (bufsize > 1) {
-            strncpy(sp, q->head->value, bufsize - 1);
-            sp[bufsize - 1] = '\0';
-        } else if (bufsize == 1)
-            sp[bufsize - 1] = '\0';
-    }
+    copy_removed(sp, bufsize, list_ele_value(q->head),
+                 list_ele_length(q->head));
     list_ele_t *tmp = q->head;
     // Maintain queue structure and free removed element
     q->size -= 1;
@@ -175,9 +802,352 @@ bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
     if (q->size == 0) {
         q->tail = NULL;
     }
-    // Free the popped element and the memeory of string
-    free(tmp->value);
-    free(tmp);
+    // Free the popped element together with its string
+    ele_release(q, tmp);
+    if (q->arena != NULL)
+        arena_maybe_compact(q);
+    return true;
+}
+
+/*
+ * Remove the tail string of a backend queue with no operation of its own
+ * for that: split off every string before it into a scratch queue, remove
+ * it from the head, then move the others back.
+ */
+static bool backend_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    queue_t *front = queue_create(q->kind, q->capacity);
+    if (front == NULL)
+        return false;
+    if (!q->backend->split(q, q_size(q) - 1, front)) {
+        q_free(front);
+        return false;
+    }
+    // Removing the only string left cannot fail, and the others then go
+    // back into an empty queue, which has room for all of them
+    bool removed = q->backend->remove_head(q, sp, bufsize);
+    bool restored = q->backend->concat(q, front);
+    assert(removed && restored);
+    (void) removed;
+    (void) restored;
+    q_free(front);
+    return true;
+}
+
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    if (q == NULL || q_size(q) == 0)
+        return false;
+    if (q->backend != NULL && q->backend->remove_tail != NULL)
+        return q->backend->remove_tail(q, sp, bufsize);
+    if (q->backend != NULL)
+        return backend_remove_tail(q, sp, bufsize);
+    list_ele_t *last = q->tail;
+    copy_removed(sp, bufsize, list_ele_value(last), list_ele_length(last));
+    // Only a walk from the head finds the element before the tail
+    if (q->head == last) {
+        q->head = NULL;
+        q->tail = NULL;
+    } else {
+        list_ele_t *prev = q->head;
+        while (prev->next != last)
+            prev = prev->next;
+        prev->next = NULL;
+        q->tail = prev;
+    }
+    q->size -= 1;
+    ele_release(q, last);
+    if (q->arena != NULL)
+        arena_maybe_compact(q);
+    return true;
+}
+
+char *q_peek_head(queue_t *q)
+{
+    if (q == NULL)
+        return NULL;
+    q_iter_t it;
+    q_iter_init(q, &it);
+    return q_iter_next(q, &it);
+}
+
+char *q_peek_tail(queue_t *q)
+{
+    if (q == NULL)
+        return NULL;
+    if (q->backend == NULL)
+        return q->tail != NULL ? list_ele_value(q->tail) : NULL;
+    if (q->backend->peek_tail != NULL)
+        return q->backend->peek_tail(q);
+    q_iter_t it;
+    q_iter_init(q, &it);
+    char *s, *last = NULL;
+    while ((s = q_iter_next(q, &it)) != NULL)
+        last = s;
+    return last;
+}
+
+bool q_remove_head_wait(queue_t *q, char *sp, size_t bufsize, int timeout_ms)
+{
+    if (q == NULL || q->backend == NULL || q->backend->take_head_wait == NULL)
+        return q_remove_head(q, sp, bufsize);
+    char *s = q->backend->take_head_wait(q, timeout_ms);
+    if (s == NULL)
+        return false;
+    copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+/*
+ * Attempt to remove element from head of queue without copying its string.
+ * Return true if successful, and fill *t with the detached string.
+ * Return false if queue is NULL or empty.
+ * A list-based queue unlinks the element and leaves it in t->ele, with
+ * t->value pointing at its string, inline or not: both still belong to
+ * the queue, which must not be freed before q_release_taken().  A
+ * backend hands over its own malloc'ed copy of the string instead, with
+ * t->ele NULL, which only q_release_taken() frees.
+ */
+bool q_take_head(queue_t *q, q_taken_t *t)
+{
+    if (q == NULL)
+        return false;
+    if (q->backend != NULL) {
+        t->value = q->backend->take_head(q);
+        if (t->value == NULL)
+            return false;
+        t->len = strlen(t->value);
+        t->ele = NULL;
+        return true;
+    }
+    if (q->size == 0)
+        return false;
+    list_ele_t *e = q->head;
+    q->size -= 1;
+    q->head = e->next;
+    if (q->size == 0)
+        q->tail = NULL;
+    e->next = NULL;
+    t->value = list_ele_value(e);
+    t->len = list_ele_length(e);
+    t->ele = e;
+    if (q->arena != NULL)
+        q->arena->taken += 1;
+    return true;
+}
+
+char *queue_take_block(queue_t *q)
+{
+    q_taken_t t;
+    if (!q_take_head(q, &t))
+        return NULL;
+    list_ele_t *e = t.ele;
+    if (!list_ele_is_local(e)) {
+        free(e);
+        return t.value;
+    }
+    memmove(e, t.value, t.len + 1);
+    return (char *) e;
+}
+
+/*
+ * Free the string taken from queue q by q_take_head(): the block in
+ * t->value if t->ele is NULL, otherwise element t->ele, giving its
+ * string back along with it.  Leave *t empty.
+ */
+void q_release_taken(queue_t *q, q_taken_t *t)
+{
+    if (t->ele == NULL) {
+        free(t->value);
+    } else {
+        ele_release(q, t->ele);
+        if (q->arena != NULL) {
+            q->arena->taken -= 1;
+            arena_maybe_compact(q);
+        }
+    }
+    t->value = NULL;
+    t->ele = NULL;
+}
+
+/*
+ * Drain a backend queue one string at a time, peeking at the head to
+ * decide whether the next string still fits in buf.
+ */
+static int backend_remove_many(queue_t *q,
+                               char *buf,
+                               size_t bufsize,
+                               size_t *offsets,
+                               int n)
+{
+    size_t used = 0;
+    int cnt = 0;
+    while (cnt < n && q_size(q) > 0) {
+        if (buf == NULL) {
+            q->backend->remove_head(q, NULL, 0);
+            cnt++;
+            continue;
+        }
+        q_iter_t it;
+        q_iter_init(q, &it);
+        size_t s_lenth = strlen(q_iter_next(q, &it));
+        if (used >= bufsize || (cnt > 0 && s_lenth >= bufsize - used))
+            break;
+        q->backend->remove_head(q, buf + used, bufsize - used);
+        offsets[cnt++] = used;
+        used += strlen(buf + used) + 1;
+    }
+    return cnt;
+}
+
+/*
+ * Attempt to remove up to n elements from head of queue.
+ * If buf is non-NULL, the removed strings are copied one after the other
+ * into buf, each with its null terminator, and offsets[i] is set to where
+ * the i-th string starts.  Removal stops before a string that does not
+ * fit in the rest of buf, except for the first one, which is then
+ * truncated as q_remove_head() would.
+ * Return the number of elements removed, 0 if q is NULL or empty.
+ */
+int q_remove_head_many(queue_t *q,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets,
+                       int n)
+{
+    if (q == NULL)
+        return 0;
+    if (q->backend != NULL)
+        return backend_remove_many(q, buf, bufsize, offsets, n);
+    size_t used = 0;
+    int cnt = 0;
+    list_ele_t *e = q->head;
+    // Copy out and release each element in the same pass
+    while (e != NULL && cnt < n) {
+        if (buf != NULL) {
+            size_t s_lenth = list_ele_length(e);
+            if (used >= bufsize || (cnt > 0 && s_lenth >= bufsize - used))
+                break;
+            if (s_lenth >= bufsize - used)
+                s_lenth = bufsize - used - 1;
+            copy_removed(buf + used, bufsize - used, list_ele_value(e),
+                         s_lenth);
+            offsets[cnt] = used;
+            used += s_lenth + 1;
+        }
+        list_ele_t *next = e->next;
+        ele_release(q, e);
+        e = next;
+        cnt++;
+    }
+    // Maintain the queue structure
+    q->head = e;
+    q->size -= cnt;
+    if (q->size == 0)
+        q->tail = NULL;
+    if (q->arena != NULL && cnt > 0)
+        arena_maybe_compact(q);
+    return cnt;
+}
+
+/*
+ * Make list-based queues a and b of the same kind draw from the same pool
+ * or arena, so that elements can move between them.  The allocator of
+ * one is folded into that of the other, which takes constant time.
+ * Return false if neither allocator can be folded, because both are
+ * shared with some other queue already.
+ */
+static bool share_allocator(queue_t *a, queue_t *b)
+{
+    if (a->pool != b->pool) {
+        if (b->pool->refs == 1) {
+            pool_fold(a->pool, b->pool);
+            b->pool = a->pool;
+        } else if (a->pool->refs == 1) {
+            pool_fold(b->pool, a->pool);
+            a->pool = b->pool;
+        } else {
+            return false;
+        }
+    }
+    if (a->arena != b->arena) {
+        if (b->arena->refs == 1) {
+            arena_fold(a->arena, b->arena);
+            b->arena = a->arena;
+        } else if (a->arena->refs == 1) {
+            arena_fold(b->arena, a->arena);
+            a->arena = b->arena;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Append the n elements from first to last to the tail of queue q */
+static void list_append(queue_t *q,
+                        list_ele_t *first,
+                        list_ele_t *last,
+                        unsigned int n)
+{
+    if (n == 0)
+        return;
+    if (q->head == NULL)
+        q->head = first;
+    else
+        q->tail->next = first;
+    q->tail = last;
+    q->size += n;
+}
+
+/*
+ * Move all elements of src to the tail of dst, leaving src empty.
+ * Return false if either queue is NULL, they are the same queue, of
+ * different kinds, or their elements could not be moved.
+ */
+bool q_concat(queue_t *dst, queue_t *src)
+{
+    if (dst == NULL || src == NULL || dst == src || dst->kind != src->kind)
+        return false;
+    if (dst->backend != NULL)
+        return dst->backend->concat(dst, src);
+    if (!share_allocator(dst, src))
+        return false;
+    list_append(dst, src->head, src->tail, src->size);
+    src->head = NULL;
+    src->tail = NULL;
+    src->size = 0;
+    return true;
+}
+
+/*
+ * Move the first k elements of q to the tail of out.
+ * Return false if either queue is NULL, they are the same queue, of
+ * different kinds, q has fewer than k elements, or they could not be
+ * moved.
+ */
+bool q_split(queue_t *q, int k, queue_t *out)
+{
+    if (q == NULL || out == NULL || q == out || q->kind != out->kind ||
+        k < 0 || k > q_size(q))
+        return false;
+    if (q->backend != NULL)
+        return q->backend->split(q, k, out);
+    if (!share_allocator(q, out))
+        return false;
+    if (k == 0)
+        return true;
+    list_ele_t *first = q->head;
+    list_ele_t *last = first;
+    for (int i = 1; i < k; i++)
+        last = last->next;
+    q->head = last->next;
+    if (q->head == NULL)
+        q->tail = NULL;
+    q->size -= k;
+    last->next = NULL;
+    list_append(out, first, last, k);
     return true;
 }
 
@@ -192,7 +1162,20 @@ int q_size(queue_t *q)
         printf("ERROR: No size of a NULL queue\n");
         return 0;
     }
-    return q->size;
+    if (q->backend != NULL && q->backend->size != NULL)
+        return q->backend->size(q);
+    // Thread-safe backends update the size from several threads
+    return __atomic_load_n(&q->size, __ATOMIC_RELAXED);
+}
+
+bool q_thread_safe(queue_t *q)
+{
+    return q != NULL && q->backend != NULL && q->backend->thread_safe;
+}
+
+bool q_spsc_safe(queue_t *q)
+{
+    return q != NULL && q->backend != NULL && q->backend->spsc_safe;
 }
 
 /*
@@ -208,6 +1191,10 @@ void q_reverse(queue_t *q)
         printf("ERROR: Reverse a NULL queue\n");
         return;
     }
+    if (q->backend != NULL) {
+        q->backend->reverse(q);
+        return;
+    }
     list_ele_t *prev_ptr = NULL;
     list_ele_t *current_ptr = q->head;
     list_ele_t *next_ptr = NULL;
@@ -223,60 +1210,624 @@ void q_reverse(queue_t *q)
     q->head = tmp;
 }
 
+/*
+ * Sorted run of list elements.  Runs are delimited by their tail rather
+ * than by a NULL next pointer, so that they can stay linked to the rest
+ * of the list.
+ */
+typedef struct {
+    list_ele_t *head;
+    list_ele_t *tail;
+    unsigned int len;
+} run_t;
+
+/* Compare the strings of list elements a and b */
+static inline int ele_cmp(list_ele_t *a, list_ele_t *b)
+{
+    return strnatcmp(list_ele_value(a), list_ele_value(b));
+}
+
+/*
+ * Wins in a row after which a merge checks whether the tail of the
+ * winning run still precedes the head of the other one, in which case
+ * the rest of the winner is moved over at once.  A list offers no
+ * random access to gallop through, so this is the whole of galloping.
+ */
+#define MIN_GALLOP 7
+
+/*
+ * Bound on pending runs.  Their lengths grow at least as fast as the
+ * Fibonacci numbers from the bottom of the stack up, so this is plenty
+ * for any queue whose size fits an unsigned int.
+ */
+#define SORT_MAX_RUNS 64
+
+/* Built-in orders of q_sort_by() */
+
+int q_cmp_bytes(const char *a, const char *b)
+{
+    return strcmp(a, b);
+}
+
+int q_cmp_nocase(const char *a, const char *b)
+{
+    return strcasecmp(a, b);
+}
+
+int q_cmp_natural(const char *a, const char *b)
+{
+    return strnatcmp(a, b);
+}
+
+int q_cmp_natural_nocase(const char *a, const char *b)
+{
+    return strnatcasecmp(a, b);
+}
+
+int q_cmp_length(const char *a, const char *b)
+{
+    size_t la = strlen(a), lb = strlen(b);
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    return strcmp(a, b);
+}
+
+int q_cmp_bytes_desc(const char *a, const char *b)
+{
+    return q_cmp_bytes(b, a);
+}
+
+int q_cmp_nocase_desc(const char *a, const char *b)
+{
+    return q_cmp_nocase(b, a);
+}
+
+int q_cmp_natural_desc(const char *a, const char *b)
+{
+    return q_cmp_natural(b, a);
+}
+
+int q_cmp_natural_nocase_desc(const char *a, const char *b)
+{
+    return q_cmp_natural_nocase(b, a);
+}
+
+int q_cmp_length_desc(const char *a, const char *b)
+{
+    return q_cmp_length(b, a);
+}
+
+/* Length order of list elements, whose lengths are known without strlen */
+static inline int ele_cmp_length(list_ele_t *a, list_ele_t *b)
+{
+    size_t la = list_ele_length(a), lb = list_ele_length(b);
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    return memcmp(list_ele_value(a), list_ele_value(b), la);
+}
+
+/* One merge sort per built-in order, then one for any other comparator */
+
+#define SORT_NAME bytes
+#define SORT_CMP(a, b) strcmp(list_ele_value(a), list_ele_value(b))
+#include "sort_impl.h"
+
+#define SORT_NAME bytes_desc
+#define SORT_CMP(a, b) strcmp(list_ele_value(b), list_ele_value(a))
+#include "sort_impl.h"
+
+#define SORT_NAME nocase
+#define SORT_CMP(a, b) strcasecmp(list_ele_value(a), list_ele_value(b))
+#include "sort_impl.h"
+
+#define SORT_NAME nocase_desc
+#define SORT_CMP(a, b) strcasecmp(list_ele_value(b), list_ele_value(a))
+#include "sort_impl.h"
+
+#define SORT_NAME natural
+#define SORT_CMP(a, b) strnatcmp(list_ele_value(a), list_ele_value(b))
+#include "sort_impl.h"
+
+#define SORT_NAME natural_desc
+#define SORT_CMP(a, b) strnatcmp(list_ele_value(b), list_ele_value(a))
+#include "sort_impl.h"
+
+#define SORT_NAME natural_nocase
+#define SORT_CMP(a, b) strnatcasecmp(list_ele_value(a), list_ele_value(b))
+#include "sort_impl.h"
+
+#define SORT_NAME natural_nocase_desc
+#define SORT_CMP(a, b) strnatcasecmp(list_ele_value(b), list_ele_value(a))
+#include "sort_impl.h"
+
+#define SORT_NAME length
+#define SORT_CMP(a, b) ele_cmp_length(a, b)
+#include "sort_impl.h"
+
+#define SORT_NAME length_desc
+#define SORT_CMP(a, b) ele_cmp_length(b, a)
+#include "sort_impl.h"
+
+#define SORT_NAME generic
+#define SORT_CMP(a, b) cmp(list_ele_value(a), list_ele_value(b))
+#include "sort_impl.h"
+
+/* Built-in orders, and the merge sort specialized to each */
+static const struct {
+    q_cmp_t cmp;
+    void (*sort_list)(run_t *r, q_cmp_t cmp);
+} builtin_sorts[] = {
+    {q_cmp_bytes, bytes_sort_list},
+    {q_cmp_bytes_desc, bytes_desc_sort_list},
+    {q_cmp_nocase, nocase_sort_list},
+    {q_cmp_nocase_desc, nocase_desc_sort_list},
+    {q_cmp_natural, natural_sort_list},
+    {q_cmp_natural_desc, natural_desc_sort_list},
+    {q_cmp_natural_nocase, natural_nocase_sort_list},
+    {q_cmp_natural_nocase_desc, natural_nocase_desc_sort_list},
+    {q_cmp_length, length_sort_list},
+    {q_cmp_length_desc, length_desc_sort_list},
+};
+
 /*
  * Sort elements of queue in ascending order
  * No effect if q is NULL or empty. In addition, if q has only one
  * element, do nothing.
  */
-// new q_sort with merge sort
 void q_sort(queue_t *q)
 {
     if (q == NULL || q_size(q) == 0 || q_size(q) == 1)
         return;
-    // In order to avoid to extra line to handle head element
-    // case, we maintain a pseudo head.
-    list_ele_t pseudo;
-    pseudo.next = q->head;
-    for (unsigned int interval = 1; interval < q_size(q); interval *= 2) {
-        // prv is the last element of previous round
-        // nxt is the first element of next round
-        // next_prv will record where prv will move to
-        list_ele_t *prv = &pseudo;
-        list_ele_t *nxt = pseudo.next;
-        while (nxt != NULL) {
-            // cur1 and cur2 lead two lists to be sorted
-            list_ele_t *cur1 = prv->next;
-            list_ele_t *cur2 = cur1;
-            for (unsigned int i = 0; cur2 != NULL && i < interval; ++i)
-                cur2 = cur2->next;
-
-            // move next_prv and nxt to correct place
-            nxt = cur2;
-            for (unsigned int i = 0; nxt != NULL && i < interval; ++i)
-                nxt = nxt->next;
-
-            queue_t merge = {.head = NULL, .tail = NULL, .size = 0};
-            // cur1_end and cur2_end is the next element of each list
-            list_ele_t *cur1_end = cur2;
-            list_ele_t *cur2_end = nxt;
-            while (cur1 != cur1_end || cur2 != cur2_end) {
-                if (cur2 == cur2_end ||
-                    (cur1 != cur1_end &&
-                     strnatcmp(cur1->value, cur2->value) < 0)) {
-                    list_ele_t *tmp1 = cur1;
-                    cur1 = cur1->next;
-                    q_insert_element_to_tail(&merge, tmp1);
-                } else {
-                    list_ele_t *tmp2 = cur2;
-                    cur2 = cur2->next;
-                    q_insert_element_to_tail(&merge, tmp2);
-                }
-            }
-            prv->next = merge.head;
-            prv = merge.tail;
-            merge.tail->next = nxt;
-            q->tail = merge.tail;
+    if (q->backend != NULL) {
+        q->backend->sort(q, q_cmp_natural);
+        return;
+    }
+    run_t r = {q->head, NULL, 0};
+    natural_sort_list(&r, q_cmp_natural);
+    q->head = r.head;
+    q->tail = r.tail;
+}
+
+/*
+ * Sort elements of queue in the order of cmp, keeping equal strings in
+ * their order.  The built-in orders get a sort with the comparison
+ * inlined, any other comparator is called through its pointer.
+ * No effect if q or cmp is NULL, or q has fewer than two elements.
+ */
+void q_sort_by(queue_t *q, q_cmp_t cmp)
+{
+    if (q == NULL || cmp == NULL || q_size(q) < 2)
+        return;
+    if (q->backend != NULL) {
+        q->backend->sort(q, cmp);
+        return;
+    }
+    void (*sort_list)(run_t *r, q_cmp_t cmp) = generic_sort_list;
+    for (size_t i = 0; i < sizeof(builtin_sorts) / sizeof(builtin_sorts[0]);
+         i++) {
+        if (builtin_sorts[i].cmp == cmp)
+            sort_list = builtin_sorts[i].sort_list;
+    }
+    run_t r = {q->head, NULL, 0};
+    sort_list(&r, cmp);
+    q->head = r.head;
+    q->tail = r.tail;
+}
+
+/*
+ * Parallel sort.
+ * The list is cut into one segment per thread in a single walk, the
+ * segments are sorted concurrently, and then merged pairwise up a tree,
+ * the merges of each level running concurrently.  Nothing is allocated
+ * per element, and workers only touch the elements of their own runs.
+ * The harness alarm is held off until the list is whole again and every
+ * worker has been joined, since leaving the sort half way through would
+ * leave workers relinking elements of a queue about to be freed.
+ */
+
+/* Fewest elements worth handing to a thread of their own */
+#define SORT_PARALLEL_MIN 4096
+
+/* Sort run a, or merge run b into it if b is not NULL */
+typedef struct {
+    run_t *a;
+    const run_t *b;
+} sort_job_t;
+
+static void *sort_job(void *arg)
+{
+    sort_job_t *job = arg;
+    if (job->b == NULL)
+        natural_sort_list(job->a, q_cmp_natural);
+    else
+        natural_merge_runs(job->a, job->b, q_cmp_natural);
+    return NULL;
+}
+
+/*
+ * Run n independent jobs, one per thread, the last one on the calling
+ * thread, and return once all are done.  Workers block all signals, so
+ * that none of them takes the harness alarm.  Jobs whose thread could
+ * not be started are run on the calling thread as well.
+ */
+static void run_sort_jobs(sort_job_t *jobs, unsigned int n)
+{
+    pthread_t tid[Q_SORT_MAX_THREADS];
+    bool started[Q_SORT_MAX_THREADS];
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (unsigned int i = 0; i + 1 < n; i++)
+        started[i] = pthread_create(&tid[i], NULL, sort_job, &jobs[i]) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    sort_job(&jobs[n - 1]);
+    for (unsigned int i = 0; i + 1 < n; i++) {
+        if (started[i])
+            pthread_join(tid[i], NULL);
+        else
+            sort_job(&jobs[i]);
+    }
+}
+
+/*
+ * Sort elements of queue in ascending order, as q_sort() does, with up
+ * to the given number of threads.
+ */
+void q_sort_parallel(queue_t *q, int threads)
+{
+    if (q == NULL || q_size(q) < 2)
+        return;
+    unsigned int t = q->size / SORT_PARALLEL_MIN;
+    if (threads < (int) t)
+        t = threads > 0 ? threads : 1;
+    if (t > Q_SORT_MAX_THREADS)
+        t = Q_SORT_MAX_THREADS;
+    if (q->backend != NULL || t < 2) {
+        q_sort(q);
+        return;
+    }
+
+    sigset_t alarm, old;
+    sigemptyset(&alarm);
+    sigaddset(&alarm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm, &old);
+
+    run_t seg[Q_SORT_MAX_THREADS];
+    sort_job_t jobs[Q_SORT_MAX_THREADS];
+    list_ele_t *e = q->head;
+    for (unsigned int i = 0; i < t; i++) {
+        unsigned int len = q->size / t + (i < q->size % t);
+        seg[i].head = e;
+        for (unsigned int k = 1; k < len; k++)
+            e = e->next;
+        list_ele_t *last = e;
+        e = last->next;
+        last->next = NULL;
+        jobs[i].a = &seg[i];
+        jobs[i].b = NULL;
+    }
+    run_sort_jobs(jobs, t);
+
+    for (unsigned int step = 1; step < t; step *= 2) {
+        unsigned int n = 0;
+        for (unsigned int i = 0; i + step < t; i += 2 * step) {
+            jobs[n].a = &seg[i];
+            jobs[n++].b = &seg[i + step];
         }
+        run_sort_jobs(jobs, n);
     }
-    q->head = pseudo.next;
-}
\ No newline at end of file
+    q->head = seg[0].head;
+    q->tail = seg[0].tail;
+    q->tail->next = NULL;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Keyed sort.
+ * The strnatcmp order of two strings is mostly decided by their first
+ * few characters, so each element gets an 8-byte key prefix whose
+ * integer order agrees with it, computed once up front.  Comparisons
+ * then only go back to strnatcmp when two prefixes are equal.
+ */
+
+typedef struct {
+    uint64_t prefix;
+    list_ele_t *e;
+} sort_key_t;
+
+/* Key prefix of string s: the first bytes of its strnatxfrm() transform */
+static uint64_t key_prefix(const char *s)
+{
+    unsigned char xfrm[sizeof(uint64_t)] = {0};
+    strnatxfrm(xfrm, s, sizeof(xfrm));
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < sizeof(xfrm); i++)
+        prefix = prefix << 8 | xfrm[i];
+    return prefix;
+}
+
+/*
+ * Whether a prefix holds all of its transform, so that strings with equal
+ * prefixes compare equal.  Only the end of a string is transformed into
+ * a byte of 0x80.
+ */
+static inline bool key_complete(uint64_t prefix)
+{
+    uint64_t v = prefix ^ 0x8080808080808080ULL;
+    return ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0;
+}
+
+static inline int key_cmp(const sort_key_t *a, const sort_key_t *b)
+{
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    if (key_complete(a->prefix))
+        return 0;
+    return ele_cmp(a->e, b->e);
+}
+
+#define ARRAY_SORT_NAME key_merge_sort
+#define ARRAY_SORT_TYPE sort_key_t
+#define ARRAY_SORT_CMP(a, b) key_cmp(&(a), &(b))
+#include "array_sort_impl.h"
+
+/* Sort list queue q through keys, return false if could not allocate */
+static bool q_sort_keyed(queue_t *q)
+{
+    size_t n = q->size;
+    sort_key_t *keys = malloc(q_sort_scratch(q, Q_SORT_KEYED));
+    if (keys == NULL)
+        return false;
+    size_t i = 0;
+    for (list_ele_t *e = q->head; e != NULL; e = e->next) {
+        keys[i].prefix = key_prefix(list_ele_value(e));
+        keys[i++].e = e;
+    }
+    sort_key_t *sorted = key_merge_sort(keys, keys + n, n);
+    // Relink the list in sorted order
+    for (i = 0; i + 1 < n; i++)
+        sorted[i].e->next = sorted[i + 1].e;
+    q->head = sorted[0].e;
+    q->tail = sorted[n - 1].e;
+    q->tail->next = NULL;
+    free(keys);
+    return true;
+}
+
+/*
+ * Gather sort.
+ * Element pointers are copied into an array, which is merge sorted
+ * bottom up and then relinked in one pass.  Merges walk the array in
+ * order, so the elements about to be compared are known a few steps
+ * ahead and can be prefetched, which walking the list itself does not
+ * allow.
+ */
+
+#define ARRAY_SORT_NAME ele_merge_sort
+#define ARRAY_SORT_TYPE list_ele_t *
+#define ARRAY_SORT_CMP(a, b) ele_cmp(a, b)
+#define ARRAY_SORT_PREFETCH(e) __builtin_prefetch(e)
+#include "array_sort_impl.h"
+
+/* Sort list queue q through an array, return false if could not allocate */
+static bool q_sort_gather(queue_t *q)
+{
+    size_t n = q->size;
+    list_ele_t **a = malloc(q_sort_scratch(q, Q_SORT_GATHER));
+    if (a == NULL)
+        return false;
+    size_t i = 0;
+    for (list_ele_t *e = q->head; e != NULL; e = e->next)
+        a[i++] = e;
+    list_ele_t **sorted = ele_merge_sort(a, a + n, n);
+    for (i = 0; i + 1 < n; i++)
+        sorted[i]->next = sorted[i + 1];
+    q->head = sorted[0];
+    q->tail = sorted[n - 1];
+    q->tail->next = NULL;
+    free(a);
+    return true;
+}
+
+/*
+ * MSD radix sort.
+ * Elements are dealt by the byte of their string at depth d into a
+ * table of buckets, each of which is then sorted from depth d + 1 on.
+ * Every bucket but the largest is sorted by recursion, and is at most
+ * half as long as the run it came from, so that recursion goes no more
+ * than log2(n) deep.  The largest bucket is carried on with by the loop,
+ * while the buckets before and after it pile up in front and behind.
+ * Strings that end at depth d all land in bucket 0 and are equal.  Long
+ * shared prefixes, such as those of duplicates, are skipped in one pass
+ * once a byte fails to split a run.
+ */
+
+/* Runs up to this length are finished off by insertion sort */
+#define RADIX_SMALL 32
+
+/* Append run b to run a, either of which may be empty */
+static inline void run_append(run_t *a, const run_t *b)
+{
+    if (b->len == 0)
+        return;
+    if (a->len == 0) {
+        *a = *b;
+        return;
+    }
+    a->tail->next = b->head;
+    a->tail = b->tail;
+    a->len += b->len;
+}
+
+/*
+ * Stable insertion sort of run r in byte order, skipping the first d
+ * bytes, which all its strings share.  Each element is first checked
+ * against the tail, so that sorted runs and equal strings take linear
+ * time.
+ */
+static void radix_insertion_sort(run_t *r, size_t d)
+{
+    list_ele_t *e = r->head->next;
+    r->tail = r->head;
+    for (unsigned int i = 1; i < r->len; i++) {
+        list_ele_t *next = e->next;
+        const char *s = list_ele_value(e) + d;
+        if (strcmp(list_ele_value(r->tail) + d, s) <= 0) {
+            r->tail->next = e;
+            r->tail = e;
+        } else {
+            // The tail is larger, so the walk stops before it
+            list_ele_t **link = &r->head;
+            while (strcmp(list_ele_value(*link) + d, s) <= 0)
+                link = &(*link)->next;
+            e->next = *link;
+            *link = e;
+        }
+        e = next;
+    }
+}
+
+/* Length of the prefix all strings of run r share past their d-th byte */
+static size_t run_common_prefix(const run_t *r, size_t d)
+{
+    const char *first = list_ele_value(r->head) + d;
+    size_t shared = strlen(first);
+    list_ele_t *e = r->head->next;
+    for (unsigned int i = 1; i < r->len && shared > 0; i++) {
+        const char *s = list_ele_value(e) + d;
+        size_t k = 0;
+        while (k < shared && s[k] == first[k])
+            k++;
+        shared = k;
+        e = e->next;
+    }
+    return shared;
+}
+
+/* Sort run r in byte order, skipping the first d bytes of its strings */
+static void radix_sort(run_t *r, size_t d)
+{
+    run_t front = {NULL, NULL, 0}, back = {NULL, NULL, 0};
+    while (r->len > RADIX_SMALL) {
+        run_t bucket[UCHAR_MAX + 1];
+        for (unsigned int c = 0; c <= UCHAR_MAX; c++)
+            bucket[c].len = 0;
+        list_ele_t *e = r->head;
+        for (unsigned int i = 0; i < r->len; i++) {
+            run_t *b = &bucket[(unsigned char) list_ele_value(e)[d]];
+            if (b->len++ == 0)
+                b->head = e;
+            else
+                b->tail->next = e;
+            b->tail = e;
+            e = e->next;
+        }
+
+        unsigned int big = 0;
+        for (unsigned int c = 1; c <= UCHAR_MAX; c++)
+            if (bucket[c].len > bucket[big].len)
+                big = c;
+        if (big != 0 && bucket[big].len == r->len) {
+            // Nothing was split apart, skip all the bytes still shared
+            *r = bucket[big];
+            d += 1 + run_common_prefix(r, d + 1);
+            continue;
+        }
+        run_t after = {NULL, NULL, 0};
+        for (unsigned int c = 0; c <= UCHAR_MAX; c++) {
+            if (c == big)
+                continue;
+            if (c != 0 && bucket[c].len > 1)
+                radix_sort(&bucket[c], d + 1);
+            run_append(c < big ? &front : &after, &bucket[c]);
+        }
+        run_append(&after, &back);
+        back = after;
+        *r = bucket[big];
+        if (big == 0)
+            break;
+        d++;
+    }
+    if (r->len > 1)
+        radix_insertion_sort(r, d);
+    run_append(&front, r);
+    run_append(&front, &back);
+    *r = front;
+}
+
+/*
+ * Sort elements of queue in ascending order, as q_sort() does, using the
+ * given algorithm.  Modes that need scratch space fall back to q_sort()
+ * if they could not allocate it.  Q_SORT_RADIX sorts in byte order
+ * rather than natural order, and allocates nothing.
+ */
+void q_sort_mode(queue_t *q, q_sort_mode_t mode)
+{
+    if (q == NULL || q_size(q) < 2)
+        return;
+    if (mode == Q_SORT_RADIX) {
+        if (q->backend != NULL) {
+            q->backend->sort(q, q_cmp_bytes);
+            return;
+        }
+        run_t r = {q->head, q->tail, q->size};
+        radix_sort(&r, 0);
+        q->head = r.head;
+        q->tail = r.tail;
+        q->tail->next = NULL;
+        return;
+    }
+    bool sorted = false;
+    if (q->backend == NULL && mode == Q_SORT_KEYED)
+        sorted = q_sort_keyed(q);
+    else if (q->backend == NULL && mode == Q_SORT_GATHER)
+        sorted = q_sort_gather(q);
+    if (!sorted)
+        q_sort(q);
+}
+
+/*
+ * Return the most bytes q_sort_mode() allocates, in a single block that
+ * it frees before returning, when sorting queue q in the given mode.
+ */
+size_t q_sort_scratch(queue_t *q, q_sort_mode_t mode)
+{
+    if (q == NULL || q->size < 2 || q->backend != NULL)
+        return 0;
+    // Keys or element pointers, and as many again to merge them into
+    if (mode == Q_SORT_KEYED)
+        return sizeof(sort_key_t) * 2 * q->size;
+    if (mode == Q_SORT_GATHER)
+        return sizeof(list_ele_t *) * 2 * q->size;
+    return 0;
+}
+
+/*
+ * Start a walk over the elements of queue q, from head to tail.
+ * q must not be NULL.
+ */
+void q_iter_init(queue_t *q, q_iter_t *it)
+{
+    if (q->backend != NULL) {
+        q->backend->iter_init(q, it);
+        return;
+    }
+    it->node = q->head;
+    it->idx = 0;
+}
+
+/*
+ * Return the string at the current position of the walk and move on to
+ * the next element.
+ * Return NULL once the walk has gone past the tail.
+ */
+char *q_iter_next(queue_t *q, q_iter_t *it)
+{
+    if (q->backend != NULL)
+        return q->backend->iter_next(q, it);
+    list_ele_t *e = it->node;
+    if (e == NULL)
+        return NULL;
+    it->node = e->next;
+    return list_ele_value(e);
+}
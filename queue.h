@@ -13,15 +13,83 @@
 
 /* Data structure declarations */
 
-/* Linked list element (You shouldn't need to change this) */
+/*
+ * Strings shorter than this are stored inside the list element itself.
+ * The last byte of the inline buffer holds ELE_LOCAL_SIZE - 1 - length,
+ * which doubles as the null terminator for a string of maximal length,
+ * ELE_HEAP_TAG when the string lives in a block of its own, or
+ * ELE_INTERN_TAG when it is shared through the intern pool.
+ */
+#define ELE_LOCAL_SIZE 24
+#define ELE_HEAP_TAG 0xff
+#define ELE_INTERN_TAG 0xfe
+
+/* Linked list element */
 typedef struct ELE {
-    /* Pointer to array holding string.
-     * This array needs to be explicitly allocated and freed
-     */
-    char *value;
     struct ELE *next;
+    union {
+        char local[ELE_LOCAL_SIZE];
+        struct {
+            char *ptr;
+            size_t len;
+        } heap;
+    } str;
 } list_ele_t;
 
+/* Whether the string of list element e is stored inline */
+static inline bool list_ele_is_local(const list_ele_t *e)
+{
+    return (unsigned char) e->str.local[ELE_LOCAL_SIZE - 1] < ELE_INTERN_TAG;
+}
+
+/* Whether the string of list element e is shared through the intern pool */
+static inline bool list_ele_is_interned(const list_ele_t *e)
+{
+    return (unsigned char) e->str.local[ELE_LOCAL_SIZE - 1] == ELE_INTERN_TAG;
+}
+
+/* Return the string held by list element e */
+static inline char *list_ele_value(list_ele_t *e)
+{
+    return list_ele_is_local(e) ? e->str.local : e->str.heap.ptr;
+}
+
+/* Return the length of the string held by list element e */
+static inline size_t list_ele_length(const list_ele_t *e)
+{
+    if (list_ele_is_local(e))
+        return ELE_LOCAL_SIZE - 1 - e->str.local[ELE_LOCAL_SIZE - 1];
+    return e->str.heap.len;
+}
+
+/* Queue variants selectable at creation time */
+typedef enum {
+    Q_PLAIN,     /* Every element is a separate malloc'ed block */
+    Q_POOL,      /* Elements are carved out of per-queue slabs and recycled */
+    Q_ARENA,     /* Elements are bump-allocated and released all at once */
+    Q_UNROLLED,  /* Unrolled list of cache-line sized nodes of strings */
+    Q_RING,      /* Growable circular array of strings */
+    Q_LOCKFREE,  /* Lock-free linked queue, see q_thread_safe() */
+    Q_TWOLOCK,   /* Linked queue with separate head and tail locks, likewise */
+    Q_BOUNDED,   /* Blocking queue of limited capacity, see q_new_bounded() */
+    Q_SPSC,      /* Ring for one producer and one consumer, see q_new_spsc() */
+    Q_COMBINING, /* Plain queue behind a flat-combining lock, thread-safe */
+    Q_DEQUE,     /* Doubly linked list, with O(1) q_remove_tail, q_reverse */
+} q_kind_t;
+
+/* Capacity of Q_BOUNDED and Q_SPSC queues made by q_new_kind() */
+#define Q_BOUNDED_CAPACITY 1024
+
+/* Largest capacity of a Q_SPSC queue */
+#define Q_SPSC_MAX_CAPACITY (1U << 31)
+
+/* Per-queue allocators, private to queue.c */
+struct POOL;
+struct ARENA;
+
+/* Operations of variants not built on list_ele_t, see backend.h */
+struct BACKEND;
+
 /* Queue structure */
 typedef struct {
     list_ele_t *head; /* Linked list of elements */
@@ -29,12 +97,43 @@ typedef struct {
     // q_size()
     list_ele_t *tail;
     unsigned int size;
-    /* TODO: You will need to add more fields to this structure
-     *        to efficiently implement q_size and q_insert_tail.
-     */
-    /* TODO: Remove the above comment when you are about to implement. */
+    unsigned int capacity; /* Most elements a Q_BOUNDED or Q_SPSC queue holds */
+    q_kind_t kind;
+    bool intern;                   /* Share long strings, see q_set_intern() */
+    struct POOL *pool;             /* NULL unless kind is Q_POOL */
+    struct ARENA *arena;           /* NULL unless kind is Q_ARENA */
+    const struct BACKEND *backend; /* NULL for list-based variants */
+    void *impl;                    /* Private state of the backend */
 } queue_t;
 
+/* Order of two strings, with the result convention of strcmp */
+typedef int (*q_cmp_t)(const char *a, const char *b);
+
+/* Algorithms available to q_sort_mode() */
+typedef enum {
+    Q_SORT_MERGE,  /* Natural merge sort of the list itself, as q_sort() */
+    Q_SORT_KEYED,  /* Merge sort of cached key prefixes in a scratch array */
+    Q_SORT_RADIX,  /* MSD radix sort of the list in byte order, as strcmp */
+    Q_SORT_GATHER, /* Merge sort of element pointers in a scratch array */
+} q_sort_mode_t;
+
+/* Position of a walk over the queue, see q_iter_next() */
+typedef struct {
+    void *node;
+    unsigned int idx;
+} q_iter_t;
+
+/*
+ * String detached from a queue by q_take_head().
+ * value stays valid until the string is handed back with
+ * q_release_taken().
+ */
+typedef struct {
+    char *value;
+    size_t len;      /* strlen(value) */
+    list_ele_t *ele; /* Element still holding value, NULL for backends */
+} q_taken_t;
+
 /* Operations on queue */
 
 /*
@@ -43,6 +142,37 @@ typedef struct {
  */
 queue_t *q_new();
 
+/*
+ * Create empty queue of the given variant.
+ * Return NULL if could not allocate space.
+ */
+queue_t *q_new_kind(q_kind_t kind);
+
+/*
+ * Create empty Q_BOUNDED queue, holding at most capacity elements.
+ * Return NULL if capacity is 0 or could not allocate space.
+ */
+queue_t *q_new_bounded(unsigned int capacity);
+
+/*
+ * Create empty Q_SPSC queue, holding at most capacity elements, which
+ * one thread may fill while another drains it, see q_spsc_safe().
+ * Return NULL if capacity is 0 or above Q_SPSC_MAX_CAPACITY, or could
+ * not allocate space.
+ */
+queue_t *q_new_spsc(unsigned int capacity);
+
+/*
+ * Set whether strings inserted into queue from now on are interned.
+ * While they are, a string too long to be stored inline is not copied:
+ * the element refers to a single copy in the intern pool instead, shared
+ * with all equal strings of every queue, and counted so that it goes
+ * away with the last element referring to it.  Strings already in the
+ * queue are left as they are.
+ * Only Q_PLAIN and Q_POOL queues intern, no effect on other kinds.
+ */
+void q_set_intern(queue_t *q, bool intern);
+
 /*
  * Free ALL storage used by queue.
  * No effect if q is NULL
@@ -67,6 +197,33 @@ bool q_insert_head(queue_t *q, char *s);
  */
 bool q_insert_tail(queue_t *q, char *s);
 
+/*
+ * Attempt to insert element at tail of queue as q_insert_tail() does,
+ * waiting while a bounded queue is full: up to timeout_ms milliseconds,
+ * or for as long as it takes if timeout_ms is negative.
+ * Return false if q is NULL, could not allocate space, or the queue was
+ * still full at the deadline.
+ */
+bool q_insert_tail_wait(queue_t *q, char *s, int timeout_ms);
+
+/*
+ * Attempt to insert n elements at head of queue, with the same result as
+ * calling q_insert_head() on sv[0], sv[1], ... sv[n-1] in turn, or on
+ * sv[0] n times if repeat is true.
+ * Return the number of elements inserted, which is less than n if some
+ * could not be allocated, and 0 if q is NULL.
+ */
+int q_insert_head_many(queue_t *q, char **sv, int n, bool repeat);
+
+/*
+ * Attempt to insert n elements at tail of queue, with the same result as
+ * calling q_insert_tail() on sv[0], sv[1], ... sv[n-1] in turn, or on
+ * sv[0] n times if repeat is true.
+ * Return the number of elements inserted, which is less than n if some
+ * could not be allocated, and 0 if q is NULL.
+ */
+int q_insert_tail_many(queue_t *q, char **sv, int n, bool repeat);
+
 /* Insert a existed list element into queue
  * Return True if success
  * Return false if insert element to a NULL queue
@@ -83,12 +240,107 @@ bool q_insert_element_to_tail(queue_t *q, list_ele_t *ele);
  */
 bool q_remove_head(queue_t *q, char *sp, size_t bufsize);
 
+/*
+ * Attempt to remove element from head of queue as q_remove_head() does,
+ * waiting while a bounded queue is empty: up to timeout_ms milliseconds,
+ * or for as long as it takes if timeout_ms is negative.  Other queues
+ * do not wait.
+ */
+bool q_remove_head_wait(queue_t *q, char *sp, size_t bufsize, int timeout_ms);
+
+/*
+ * Attempt to remove element from tail of queue, as q_remove_head() does
+ * from its head.  Takes constant time for Q_DEQUE and Q_RING queues, and
+ * time proportional to the size of the queue for the others, some of
+ * which then need to allocate space.
+ * Return false if queue is NULL or empty, or could not allocate space.
+ */
+bool q_remove_tail(queue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Return the string at the head, or at the tail, of queue q, which stays
+ * in place until the queue next changes.  Finding the tail takes
+ * constant time for list-based, Q_DEQUE and Q_RING queues, and a walk
+ * over the queue for the others.
+ * Return NULL if q is NULL or empty.
+ */
+char *q_peek_head(queue_t *q);
+char *q_peek_tail(queue_t *q);
+
+/*
+ * Attempt to remove element from head of queue without copying its string.
+ * Return true if successful, and fill *t with the detached string.
+ * Return false if queue is NULL or empty.
+ * The caller may use t->value until it calls q_release_taken(), which must
+ * happen before the queue is freed.  If t->ele is NULL, the string is a
+ * block of its own that the caller owns, otherwise the detached element
+ * and its string still belong to the queue's allocator.
+ */
+bool q_take_head(queue_t *q, q_taken_t *t);
+
+/*
+ * Free the string taken from queue q by q_take_head(), together with what
+ * is left of its list element.
+ */
+void q_release_taken(queue_t *q, q_taken_t *t);
+
+/*
+ * Attempt to remove up to n elements from head of queue.
+ * If buf is non-NULL, the removed strings are copied one after the other
+ * into buf, each with its null terminator, and offsets[i] is set to where
+ * the i-th string starts.  Removal stops before a string that does not
+ * fit in the rest of buf, except for the first one, which is then
+ * truncated as q_remove_head() would.
+ * Return the number of elements removed, 0 if q is NULL or empty.
+ */
+int q_remove_head_many(queue_t *q,
+                       char *buf,
+                       size_t bufsize,
+                       size_t *offsets,
+                       int n);
+
+/*
+ * Move all elements of src to the tail of dst, leaving src empty.
+ * No string is copied, and list-based variants take constant time.
+ * Pool and arena queues that exchanged elements share their allocator
+ * from then on.
+ * Return false if either queue is NULL, they are the same queue, of
+ * different kinds, or their elements could not be moved.
+ */
+bool q_concat(queue_t *dst, queue_t *src);
+
+/*
+ * Move the first k elements of q to the tail of out, without copying
+ * their strings.
+ * Return false if either queue is NULL, they are the same queue, of
+ * different kinds, q has fewer than k elements, or they could not be
+ * moved.
+ */
+bool q_split(queue_t *q, int k, queue_t *out);
+
 /*
  * Return number of elements in queue.
  * Return 0 if q is NULL or empty
  */
 int q_size(queue_t *q);
 
+/*
+ * Return whether threads may call q_insert_tail(), q_remove_head(),
+ * their _wait variants, q_take_head(), q_release_taken() and q_size()
+ * on queue q at the same time.  Every other operation needs the queue
+ * to itself, and so does q_free().
+ */
+bool q_thread_safe(queue_t *q);
+
+/*
+ * Return whether one thread may insert at the tail of queue q, with
+ * q_insert_tail(), q_insert_tail_many() or q_insert_tail_wait(), while
+ * another removes from its head, with q_remove_head(), q_take_head() or
+ * q_remove_head_wait(), and either may call q_size().  True for queues
+ * that are thread-safe, and for Q_SPSC queues.
+ */
+bool q_spsc_safe(queue_t *q);
+
 /*
  * Reverse elements in queue
  * No effect if q is NULL or empty
@@ -105,4 +357,66 @@ void q_reverse(queue_t *q);
  */
 void q_sort(queue_t *q);
 
+/*
+ * Built-in orders for q_sort_by(): byte order as strcmp, ignoring case
+ * as strcasecmp, natural order as strnatcmp and strnatcasecmp, and
+ * shorter strings first, then byte order.  The _desc variants sort the
+ * other way around.
+ */
+int q_cmp_bytes(const char *a, const char *b);
+int q_cmp_nocase(const char *a, const char *b);
+int q_cmp_natural(const char *a, const char *b);
+int q_cmp_natural_nocase(const char *a, const char *b);
+int q_cmp_length(const char *a, const char *b);
+int q_cmp_bytes_desc(const char *a, const char *b);
+int q_cmp_nocase_desc(const char *a, const char *b);
+int q_cmp_natural_desc(const char *a, const char *b);
+int q_cmp_natural_nocase_desc(const char *a, const char *b);
+int q_cmp_length_desc(const char *a, const char *b);
+
+/*
+ * Sort elements of queue in the order of cmp, such as one of the
+ * built-in orders above, which are faster than other comparators.
+ * List-based queues keep equal strings in their order.
+ * No effect if q or cmp is NULL, or if q has fewer than two elements.
+ */
+void q_sort_by(queue_t *q, q_cmp_t cmp);
+
+/* Most threads q_sort_parallel() sorts with */
+#define Q_SORT_MAX_THREADS 64
+
+/*
+ * Sort elements of queue in ascending order, as q_sort() does, splitting
+ * the work among up to the given number of threads.  Short queues, and
+ * backend queues, are sorted by the calling thread alone.
+ */
+void q_sort_parallel(queue_t *q, int threads);
+
+/*
+ * Sort elements of queue in ascending order, as q_sort() does, using the
+ * given algorithm.  Modes that need scratch space fall back to q_sort()
+ * if they could not allocate it.  Q_SORT_RADIX sorts in byte order
+ * rather than natural order, and allocates nothing.
+ */
+void q_sort_mode(queue_t *q, q_sort_mode_t mode);
+
+/*
+ * Return the most bytes q_sort_mode() allocates, in a single block that
+ * it frees before returning, when sorting queue q in the given mode.
+ */
+size_t q_sort_scratch(queue_t *q, q_sort_mode_t mode);
+
+/*
+ * Start a walk over the elements of queue q, from head to tail.
+ * q must not be NULL.
+ */
+void q_iter_init(queue_t *q, q_iter_t *it);
+
+/*
+ * Return the string at the current position of the walk and move on to
+ * the next element.
+ * Return NULL once the walk has gone past the tail.
+ */
+char *q_iter_next(queue_t *q, q_iter_t *it);
+
 #endif /* LAB0_QUEUE_H */
@@ -0,0 +1,388 @@
+/*
+ * Ring buffer backend for Q_RING queues.
+ *
+ * Strings are kept in a circular array whose capacity is a power of two
+ * and doubles when full.  Logical element i lives in slot
+ * (head + i * step) & mask, where step is 1, or -1 modulo the capacity
+ * once the queue has been reversed, so that q_reverse is O(1).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+/* Capacity of a new ring, must be a power of two */
+#define RING_INIT_CAPACITY 16
+
+typedef struct {
+    char **slot;
+    unsigned int mask; /* Capacity - 1 */
+    unsigned int head; /* Slot of the head element */
+    unsigned int step; /* 1, or mask when reversed */
+} ring_t;
+
+/* Slot of logical element i */
+static inline unsigned int ring_at(const ring_t *r, unsigned int i)
+{
+    return (r->head + i * r->step) & r->mask;
+}
+
+/* Step that walks the ring from tail to head */
+static inline unsigned int ring_back(const ring_t *r)
+{
+    return r->mask + 1 - r->step;
+}
+
+static bool ring_init(queue_t *q)
+{
+    ring_t *r = malloc(sizeof(ring_t));
+    if (r == NULL)
+        return false;
+    r->slot = malloc(sizeof(char *) * RING_INIT_CAPACITY);
+    if (r->slot == NULL) {
+        free(r);
+        return false;
+    }
+    r->mask = RING_INIT_CAPACITY - 1;
+    r->head = 0;
+    r->step = 1;
+    q->impl = r;
+    return true;
+}
+
+static void ring_destroy(queue_t *q)
+{
+    ring_t *r = q->impl;
+    for (unsigned int i = 0; i < q->size; i++)
+        free(r->slot[ring_at(r, i)]);
+    free(r->slot);
+    free(r);
+}
+
+/* Largest capacity a ring may grow to */
+#define RING_MAX_CAPACITY (1U << 31)
+
+/*
+ * Make room for n more strings, doubling the capacity until they fit.
+ * Strings are copied over in logical order, which also undoes any
+ * reversal.  Return false if could not allocate space.
+ */
+static bool ring_reserve(queue_t *q, int n)
+{
+    ring_t *r = q->impl;
+    size_t need = (size_t) q->size + n;
+    if (n <= 0 || need <= (size_t) r->mask + 1)
+        return true;
+    if (need > RING_MAX_CAPACITY)
+        return false;
+    unsigned int capacity = r->mask + 1;
+    while (capacity < need)
+        capacity *= 2;
+    char **slot = malloc(sizeof(char *) * capacity);
+    if (slot == NULL)
+        return false;
+    for (unsigned int i = 0; i < q->size; i++)
+        slot[i] = r->slot[ring_at(r, i)];
+    free(r->slot);
+    r->slot = slot;
+    r->mask = capacity - 1;
+    r->head = 0;
+    r->step = 1;
+    return true;
+}
+
+static bool ring_insert_head(queue_t *q, char *s)
+{
+    ring_t *r = q->impl;
+    if (!ring_reserve(q, 1))
+        return false;
+    char *copy = strdup(s);
+    if (copy == NULL)
+        return false;
+    r->head = (r->head + ring_back(r)) & r->mask;
+    r->slot[r->head] = copy;
+    q->size += 1;
+    return true;
+}
+
+static bool ring_insert_tail(queue_t *q, char *s)
+{
+    ring_t *r = q->impl;
+    if (!ring_reserve(q, 1))
+        return false;
+    char *copy = strdup(s);
+    if (copy == NULL)
+        return false;
+    r->slot[ring_at(r, q->size)] = copy;
+    q->size += 1;
+    return true;
+}
+
+static char *ring_take_head(queue_t *q)
+{
+    ring_t *r = q->impl;
+    if (q->size == 0)
+        return NULL;
+    char *s = r->slot[r->head];
+    r->head = (r->head + r->step) & r->mask;
+    q->size -= 1;
+    return s;
+}
+
+static bool ring_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    char *s = ring_take_head(q);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+static bool ring_remove_tail(queue_t *q, char *sp, size_t bufsize)
+{
+    ring_t *r = q->impl;
+    if (q->size == 0)
+        return false;
+    char *s = r->slot[ring_at(r, q->size - 1)];
+    q->size -= 1;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+static char *ring_peek_tail(queue_t *q)
+{
+    ring_t *r = q->impl;
+    return q->size > 0 ? r->slot[ring_at(r, q->size - 1)] : NULL;
+}
+
+static inline void swap_rings(queue_t *a, queue_t *b)
+{
+    void *impl = a->impl;
+    unsigned int size = a->size;
+    a->impl = b->impl;
+    a->size = b->size;
+    b->impl = impl;
+    b->size = size;
+}
+
+/*
+ * Move n string pointers from the head of ring q to the tail of ring out.
+ * Return false if could not allocate space.
+ */
+static bool ring_move(queue_t *q, unsigned int n, queue_t *out)
+{
+    ring_t *r = q->impl, *o = out->impl;
+    if (!ring_reserve(out, n))
+        return false;
+    for (unsigned int i = 0; i < n; i++)
+        o->slot[ring_at(o, out->size + i)] = r->slot[ring_at(r, i)];
+    r->head = ring_at(r, n);
+    q->size -= n;
+    out->size += n;
+    return true;
+}
+
+/*
+ * Moving a whole ring into an empty one just swaps their arrays, otherwise
+ * the string pointers are copied over, though never the strings.
+ */
+static bool ring_concat(queue_t *dst, queue_t *src)
+{
+    if (dst->size == 0) {
+        swap_rings(dst, src);
+        return true;
+    }
+    return ring_move(src, src->size, dst);
+}
+
+static bool ring_split(queue_t *q, int k, queue_t *out)
+{
+    if (out->size == 0 && (unsigned int) k == q->size) {
+        swap_rings(q, out);
+        return true;
+    }
+    return ring_move(q, k, out);
+}
+
+/* Flip the direction of the ring, the tail becomes the head */
+static void ring_reverse(queue_t *q)
+{
+    ring_t *r = q->impl;
+    if (q->size == 0)
+        return;
+    r->head = ring_at(r, q->size - 1);
+    r->step = ring_back(r);
+}
+
+void slots_reverse(char **a, unsigned int from, unsigned int to)
+{
+    while (from + 1 < to) {
+        char *tmp = a[from];
+        a[from++] = a[--to];
+        a[to] = tmp;
+    }
+}
+
+/*
+ * Move the strings to slots [0, size) without allocating, by rotating
+ * the whole array.  Their order is irrelevant since they are about to
+ * be sorted.
+ */
+static void ring_normalize(queue_t *q, ring_t *r)
+{
+    unsigned int start = r->step == 1 ? r->head : ring_at(r, q->size - 1);
+    if (start != 0) {
+        slots_reverse(r->slot, 0, start);
+        slots_reverse(r->slot, start, r->mask + 1);
+        slots_reverse(r->slot, 0, r->mask + 1);
+    }
+    r->head = 0;
+    r->step = 1;
+}
+
+static inline void swap_slots(char **a, char **b)
+{
+    char *tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Ranges up to this length are finished off by insertion sort */
+#define INSERTION_SORT_MAX 16
+
+static void insertion_sort(char **a, size_t n, q_cmp_t cmp)
+{
+    for (size_t i = 1; i < n; i++) {
+        char *s = a[i];
+        size_t j = i;
+        while (j > 0 && cmp(a[j - 1], s) > 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = s;
+    }
+}
+
+static void sift_down(char **a, size_t root, size_t n, q_cmp_t cmp)
+{
+    for (size_t child = 2 * root + 1; child < n; child = 2 * root + 1) {
+        if (child + 1 < n && cmp(a[child], a[child + 1]) < 0)
+            child++;
+        if (cmp(a[root], a[child]) >= 0)
+            return;
+        swap_slots(&a[root], &a[child]);
+        root = child;
+    }
+}
+
+static void heap_sort(char **a, size_t n, q_cmp_t cmp)
+{
+    for (size_t i = n / 2; i-- > 0;)
+        sift_down(a, i, n, cmp);
+    for (size_t end = n - 1; end > 0; end--) {
+        swap_slots(&a[0], &a[end]);
+        sift_down(a, 0, end, cmp);
+    }
+}
+
+/*
+ * Introsort: quicksort with median-of-three pivots, falling back to
+ * heapsort once depth runs out and to insertion sort on short ranges.
+ */
+static void intro_sort(char **a,
+                       size_t n,
+                       unsigned int depth,
+                       q_cmp_t cmp)
+{
+    while (n > INSERTION_SORT_MAX) {
+        if (depth-- == 0) {
+            heap_sort(a, n, cmp);
+            return;
+        }
+        size_t mid = n / 2;
+        if (cmp(a[mid], a[0]) < 0)
+            swap_slots(&a[mid], &a[0]);
+        if (cmp(a[n - 1], a[0]) < 0)
+            swap_slots(&a[n - 1], &a[0]);
+        if (cmp(a[n - 1], a[mid]) < 0)
+            swap_slots(&a[n - 1], &a[mid]);
+        char *pivot = a[mid];
+
+        size_t i = 0, j = n - 1;
+        while (true) {
+            while (cmp(a[i], pivot) < 0)
+                i++;
+            while (cmp(a[j], pivot) > 0)
+                j--;
+            if (i >= j)
+                break;
+            swap_slots(&a[i++], &a[j--]);
+        }
+        // Recurse into the smaller side, loop on the larger one
+        if (j + 1 < n - j - 1) {
+            intro_sort(a, j + 1, depth, cmp);
+            a += j + 1;
+            n -= j + 1;
+        } else {
+            intro_sort(a + j + 1, n - j - 1, depth, cmp);
+            n = j + 1;
+        }
+    }
+    insertion_sort(a, n, cmp);
+}
+
+void slots_sort(char **a, size_t n, q_cmp_t cmp)
+{
+    unsigned int depth = 0;
+    for (size_t k = n; k > 1; k >>= 1)
+        depth += 2;
+    intro_sort(a, n, depth, cmp);
+}
+
+static void ring_sort(queue_t *q, q_cmp_t cmp)
+{
+    ring_t *r = q->impl;
+    if (q->size < 2)
+        return;
+    ring_normalize(q, r);
+    slots_sort(r->slot, q->size, cmp);
+}
+
+static void ring_iter_init(queue_t *q, q_iter_t *it)
+{
+    it->node = NULL;
+    it->idx = 0;
+}
+
+static char *ring_iter_next(queue_t *q, q_iter_t *it)
+{
+    ring_t *r = q->impl;
+    if (it->idx >= q->size)
+        return NULL;
+    return r->slot[ring_at(r, it->idx++)];
+}
+
+const struct BACKEND ring_backend = {
+    .thread_safe = false,
+    .init = ring_init,
+    .destroy = ring_destroy,
+    .insert_head = ring_insert_head,
+    .insert_tail = ring_insert_tail,
+    .remove_head = ring_remove_head,
+    .take_head = ring_take_head,
+    .remove_tail = ring_remove_tail,
+    .peek_tail = ring_peek_tail,
+    .concat = ring_concat,
+    .split = ring_split,
+    .reserve = ring_reserve,
+    .reverse = ring_reverse,
+    .sort = ring_sort,
+    .iter_init = ring_iter_init,
+    .iter_next = ring_iter_next,
+};
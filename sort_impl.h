@@ -0,0 +1,176 @@
+/*
+ * Natural merge sort of a list of list_ele_t, specialized to one order.
+ *
+ * This file has no include guard: queue.c includes it once per order,
+ * after defining
+ *   SORT_NAME       prefix of the functions it defines,
+ *                   SORT_NAME_sort_list() among them
+ *   SORT_CMP(a, b)  comparison of list elements a and b, with the
+ *                   result convention of strcmp
+ * so that the comparison is inlined into the sort rather than called
+ * through a pointer.  SORT_CMP may use the cmp argument the functions
+ * all pass along, which is how the generic version calls an arbitrary
+ * comparator.  Both macros are undefined at the end.
+ */
+
+#ifndef SORT_FN
+#define SORT_CONCAT(a, b) a##_##b
+#define SORT_XCONCAT(a, b) SORT_CONCAT(a, b)
+#define SORT_FN(f) SORT_XCONCAT(SORT_NAME, f)
+#endif
+
+/*
+ * Take the natural run starting at element e: a non-descending one, or a
+ * descending one starting with a strict descent, which is reversed in
+ * place.  Equal strings of a descending run are kept in their order, so
+ * that the sort stays stable.
+ * Return the element following the run.
+ */
+static list_ele_t *SORT_FN(next_run)(list_ele_t *e, run_t *run, q_cmp_t cmp)
+{
+    list_ele_t *next = e->next;
+    run->head = e;
+    run->tail = e;
+    run->len = 1;
+    if (next != NULL && SORT_CMP(next, e) < 0) {
+        // Each smaller string goes in front, each equal one right after
+        // the last string placed, which is the last of its equals
+        list_ele_t *last = NULL;
+        int c = -1;
+        do {
+            list_ele_t *after = next->next;
+            if (c < 0) {
+                next->next = run->head;
+                run->head = next;
+            } else {
+                next->next = last->next;
+                last->next = next;
+            }
+            last = next;
+            run->len++;
+            next = after;
+        } while (next != NULL && (c = SORT_CMP(next, run->head)) <= 0);
+    } else {
+        while (next != NULL && SORT_CMP(next, run->tail) >= 0) {
+            run->tail = next;
+            run->len++;
+            next = next->next;
+        }
+    }
+    return next;
+}
+
+/*
+ * Merge run b into run a, which precedes it in the queue.  Elements of a
+ * come first among equal strings, so that the sort is stable.
+ */
+static void SORT_FN(merge_runs)(run_t *a, const run_t *b, q_cmp_t cmp)
+{
+    list_ele_t *x = a->head, *y = b->head;
+    a->len += b->len;
+    // Runs that do not overlap are simply chained
+    if (SORT_CMP(a->tail, y) <= 0) {
+        a->tail->next = y;
+        a->tail = b->tail;
+        return;
+    }
+    if (SORT_CMP(b->tail, x) < 0) {
+        b->tail->next = x;
+        a->head = y;
+        return;
+    }
+
+    list_ele_t *head, **link = &head;
+    unsigned int x_wins = 0, y_wins = 0;
+    while (true) {
+        if (SORT_CMP(x, y) <= 0) {
+            *link = x;
+            if (x == a->tail) {
+                x->next = y;
+                a->tail = b->tail;
+                break;
+            }
+            link = &x->next;
+            x = x->next;
+            y_wins = 0;
+            if (++x_wins == MIN_GALLOP) {
+                x_wins = 0;
+                if (SORT_CMP(a->tail, y) <= 0) {
+                    a->tail->next = y;
+                    a->tail = b->tail;
+                    break;
+                }
+            }
+        } else {
+            *link = y;
+            if (y == b->tail) {
+                y->next = x;
+                break;
+            }
+            link = &y->next;
+            y = y->next;
+            x_wins = 0;
+            if (++y_wins == MIN_GALLOP) {
+                y_wins = 0;
+                if (SORT_CMP(b->tail, x) < 0) {
+                    *link = y;
+                    b->tail->next = x;
+                    break;
+                }
+            }
+        }
+    }
+    a->head = head;
+}
+
+/* Merge runs i and i + 1 of the stack of n pending runs */
+static inline void SORT_FN(merge_at)(run_t *stack,
+                                     unsigned int *n,
+                                     unsigned int i,
+                                     q_cmp_t cmp)
+{
+    SORT_FN(merge_runs)(&stack[i], &stack[i + 1], cmp);
+    if (i + 2 < *n)
+        stack[i + 1] = stack[i + 2];
+    *n -= 1;
+}
+
+/*
+ * Natural merge sort of the NULL-terminated list starting at r->head,
+ * filling in r with the sorted list.
+ * The list is split into the runs it already has, and the pending ones
+ * are kept balanced as timsort does, merging the top runs until each is
+ * longer than the two above it combined.  Sorted or reversed input is a
+ * single run found in n - 1 comparisons.
+ */
+static void SORT_FN(sort_list)(run_t *r, q_cmp_t cmp)
+{
+    run_t run[SORT_MAX_RUNS];
+    unsigned int n = 0;
+    list_ele_t *e = r->head;
+    while (e != NULL) {
+        e = SORT_FN(next_run)(e, &run[n++], cmp);
+        while (n > 1) {
+            unsigned int k = n - 2;
+            if ((k > 0 && run[k - 1].len <= run[k].len + run[k + 1].len) ||
+                (k > 1 && run[k - 2].len <= run[k - 1].len + run[k].len)) {
+                if (run[k - 1].len < run[k + 1].len)
+                    k--;
+            } else if (run[k].len > run[k + 1].len) {
+                break;
+            }
+            SORT_FN(merge_at)(run, &n, k, cmp);
+        }
+    }
+    while (n > 1) {
+        unsigned int k = n - 2;
+        if (k > 0 && run[k - 1].len < run[k + 1].len)
+            k--;
+        SORT_FN(merge_at)(run, &n, k, cmp);
+    }
+    *r = run[0];
+    r->tail->next = NULL;
+}
+
+#undef SORT_NAME
+#undef SORT_CMP
@@ -0,0 +1,272 @@
+/*
+ * Single-producer single-consumer backend for Q_SPSC queues.
+ *
+ * A circular array of string pointers, sized to the power of two at or
+ * above q->capacity, with free-running head and tail indices: strings
+ * live in slots head & mask up to tail & mask, and the queue holds
+ * tail - head of them.  Only the producer moves the tail and only the
+ * consumer moves the head, each publishing its index with release
+ * ordering after touching the slot, so neither side ever waits for the
+ * other, nor takes a lock.
+ *
+ * Each index shares a cache line with its owner's last reading of the
+ * other index, and sits apart from the other side's line.  A side only
+ * reads the other's index again once the copy it has runs out: the
+ * producer when the ring looks full, the consumer when it looks empty.
+ * Bulk insertion fills all its slots before publishing the tail once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+typedef struct {
+    /* Written by the consumer */
+    unsigned int head;      /* Index of the head string */
+    unsigned int tail_seen; /* Tail as the consumer last read it */
+    char pad[CACHE_LINE - 2 * sizeof(unsigned int)];
+    /* Written by the producer */
+    unsigned int tail;      /* Index past the tail string */
+    unsigned int head_seen; /* Head as the producer last read it */
+    char pad2[CACHE_LINE - 2 * sizeof(unsigned int)];
+    /* Fixed at creation */
+    unsigned int mask; /* Slots - 1 */
+    char **slot;
+} spsc_t;
+
+/* Number of strings, while the queue is quiescent */
+static inline unsigned int spsc_count(const spsc_t *r)
+{
+    return r->tail - r->head;
+}
+
+/*
+ * Let each side forget the index of the other it last read, once an
+ * operation that needs the queue to itself has moved it.
+ */
+static inline void spsc_resync(spsc_t *r)
+{
+    r->head_seen = r->head;
+    r->tail_seen = r->tail;
+}
+
+static bool spsc_init(queue_t *q)
+{
+    spsc_t *r = malloc(sizeof(spsc_t));
+    if (r == NULL)
+        return false;
+    size_t slots = 1;
+    while (slots < q->capacity)
+        slots *= 2;
+    r->slot = malloc(sizeof(char *) * slots);
+    if (r->slot == NULL) {
+        free(r);
+        return false;
+    }
+    r->mask = slots - 1;
+    r->head = r->tail = 0;
+    spsc_resync(r);
+    q->impl = r;
+    return true;
+}
+
+static void spsc_destroy(queue_t *q)
+{
+    spsc_t *r = q->impl;
+    for (unsigned int i = r->head; i != r->tail; i++)
+        free(r->slot[i & r->mask]);
+    free(r->slot);
+    free(r);
+}
+
+static unsigned int spsc_size(queue_t *q)
+{
+    spsc_t *r = q->impl;
+    /* Head first, as the tail can only have moved further since */
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - head;
+}
+
+/*
+ * Free slots the producer may fill from tail on, reading the head again
+ * only if it last saw fewer than want of them.
+ */
+static inline unsigned int spsc_room(queue_t *q,
+                                     spsc_t *r,
+                                     unsigned int tail,
+                                     unsigned int want)
+{
+    unsigned int room = q->capacity - (tail - r->head_seen);
+    if (room < want) {
+        r->head_seen = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        room = q->capacity - (tail - r->head_seen);
+    }
+    return room;
+}
+
+static bool spsc_insert_tail(queue_t *q, char *s)
+{
+    spsc_t *r = q->impl;
+    unsigned int tail = r->tail;
+    if (spsc_room(q, r, tail, 1) == 0)
+        return false;
+    char *copy = strdup(s);
+    if (copy == NULL)
+        return false;
+    r->slot[tail & r->mask] = copy;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static int spsc_insert_tail_many(queue_t *q, char **sv, int n, bool repeat)
+{
+    spsc_t *r = q->impl;
+    unsigned int tail = r->tail;
+    unsigned int room = n > 0 ? spsc_room(q, r, tail, n) : 0;
+    unsigned int cnt = 0;
+    for (int i = 0; i < n && cnt < room; i++) {
+        char *copy = strdup(repeat ? sv[0] : sv[i]);
+        if (copy == NULL)
+            continue;
+        r->slot[(tail + cnt++) & r->mask] = copy;
+    }
+    /* The consumer sees the whole batch at once */
+    if (cnt > 0)
+        __atomic_store_n(&r->tail, tail + cnt, __ATOMIC_RELEASE);
+    return cnt;
+}
+
+static char *spsc_take_head(queue_t *q)
+{
+    spsc_t *r = q->impl;
+    unsigned int head = r->head;
+    if (head == r->tail_seen) {
+        r->tail_seen = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head == r->tail_seen)
+            return NULL;
+    }
+    char *s = r->slot[head & r->mask];
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return s;
+}
+
+static bool spsc_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    char *s = spsc_take_head(q);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+/* The remaining operations need the queue to themselves */
+
+static bool spsc_insert_head(queue_t *q, char *s)
+{
+    spsc_t *r = q->impl;
+    if (spsc_count(r) >= q->capacity)
+        return false;
+    char *copy = strdup(s);
+    if (copy == NULL)
+        return false;
+    r->head -= 1;
+    r->slot[r->head & r->mask] = copy;
+    spsc_resync(r);
+    return true;
+}
+
+/*
+ * Move n string pointers from the head of q to the tail of out, or
+ * nothing if they would not fit.
+ */
+static bool spsc_move(queue_t *q, unsigned int n, queue_t *out)
+{
+    spsc_t *r = q->impl, *o = out->impl;
+    if ((size_t) spsc_count(o) + n > out->capacity)
+        return false;
+    for (unsigned int i = 0; i < n; i++)
+        o->slot[(o->tail + i) & o->mask] = r->slot[(r->head + i) & r->mask];
+    r->head += n;
+    o->tail += n;
+    spsc_resync(r);
+    spsc_resync(o);
+    return true;
+}
+
+static bool spsc_concat(queue_t *dst, queue_t *src)
+{
+    return spsc_move(src, spsc_count(src->impl), dst);
+}
+
+static bool spsc_split(queue_t *q, int k, queue_t *out)
+{
+    return spsc_move(q, k, out);
+}
+
+static void spsc_reverse(queue_t *q)
+{
+    spsc_t *r = q->impl;
+    for (unsigned int i = r->head, j = r->tail; i != j && i != --j; i++) {
+        char *tmp = r->slot[i & r->mask];
+        r->slot[i & r->mask] = r->slot[j & r->mask];
+        r->slot[j & r->mask] = tmp;
+    }
+}
+
+/* Rotate the whole array, so that the strings take slots [0, count) */
+static void spsc_normalize(spsc_t *r)
+{
+    unsigned int count = spsc_count(r), start = r->head & r->mask;
+    if (start != 0) {
+        slots_reverse(r->slot, 0, start);
+        slots_reverse(r->slot, start, r->mask + 1);
+        slots_reverse(r->slot, 0, r->mask + 1);
+    }
+    r->head = 0;
+    r->tail = count;
+    spsc_resync(r);
+}
+
+static void spsc_sort(queue_t *q, q_cmp_t cmp)
+{
+    spsc_t *r = q->impl;
+    spsc_normalize(r);
+    slots_sort(r->slot, spsc_count(r), cmp);
+}
+
+static void spsc_iter_init(queue_t *q, q_iter_t *it)
+{
+    it->node = NULL;
+    it->idx = 0;
+}
+
+static char *spsc_iter_next(queue_t *q, q_iter_t *it)
+{
+    spsc_t *r = q->impl;
+    if (it->idx >= spsc_count(r))
+        return NULL;
+    return r->slot[(r->head + it->idx++) & r->mask];
+}
+
+const struct BACKEND spsc_backend = {
+    .thread_safe = false,
+    .spsc_safe = true,
+    .init = spsc_init,
+    .destroy = spsc_destroy,
+    .insert_head = spsc_insert_head,
+    .insert_tail = spsc_insert_tail,
+    .remove_head = spsc_remove_head,
+    .take_head = spsc_take_head,
+    .insert_tail_many = spsc_insert_tail_many,
+    .size = spsc_size,
+    .concat = spsc_concat,
+    .split = spsc_split,
+    .reverse = spsc_reverse,
+    .sort = spsc_sort,
+    .iter_init = spsc_iter_init,
+    .iter_next = spsc_iter_next,
+};
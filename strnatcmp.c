@@ -166,8 +166,101 @@ int strnatcmp(nat_char const *a, nat_char const *b)
 }
 
 
+/* Transform a string into a sort key for natural order.
+ *
+ * Write at most N bytes of the transform of SRC to DEST, and return the
+ * length of the whole transform, which if larger than N means DEST holds
+ * only its first N bytes.  Two transforms compare with memcmp over the
+ * shorter length as strnatcmp compares their strings: no transform is a
+ * proper prefix of another, and strings that strnatcmp finds equal get
+ * the same one.  A truncated transform is a prefix of the whole one, so
+ * it still orders strings whenever truncated transforms differ.
+ *
+ * The encoding follows strnatcmp0:
+ *  - whitespace is dropped;
+ *  - other characters have their top bit flipped, turning the signed
+ *    char order of strnatcmp into byte order, and the end of the string
+ *    becomes XFRM_END, the only byte of that value;
+ *  - a run of digits starting with '0' is compared left-aligned, as by
+ *    compare_left: its digits are copied, with the same flip, and end
+ *    with XFRM_RUN_END, below any digit;
+ *  - any other run of digits is compared by magnitude first, as by
+ *    compare_right: XFRM_NUMBER, which sorts above the runs starting
+ *    with '0', then the length of the run, then its digits.
+ * Markers for digit runs lie within the flipped digits, so that they
+ * sort against other characters as a digit would.
+ */
+
+#define XFRM_END ((unsigned char) ('\0' ^ 0x80))
+#define XFRM_RUN_END 0x00
+#define XFRM_NUMBER ((unsigned char) ('1' ^ 0x80))
+
+/* Lengths up to this are a single byte, see put_length() */
+#define XFRM_LENGTH_MAX 126
+
+static inline void put_byte(unsigned char *dest, size_t n, size_t *len,
+                            unsigned char c)
+{
+    if (*len < n)
+        dest[*len] = c;
+    *len += 1;
+}
+
+/* Encode the length of a digit run as bytes from 1 to 127, keeping their
+ * order: the first XFRM_LENGTH_MAX lengths take a single byte, longer
+ * ones a byte of 127 followed by the encoding of what is left. */
+static void put_length(unsigned char *dest, size_t n, size_t *len,
+                       size_t run)
+{
+    while (run > XFRM_LENGTH_MAX) {
+        put_byte(dest, n, len, XFRM_LENGTH_MAX + 1);
+        run -= XFRM_LENGTH_MAX;
+    }
+    put_byte(dest, n, len, (unsigned char) run);
+}
+
+
+size_t strnatxfrm(unsigned char *dest, nat_char const *src, size_t n)
+{
+    size_t len = 0;
+
+    while (1) {
+        nat_char c = *src;
+
+        while (nat_isspace(c))
+            c = *++src;
+
+        if (!c) {
+            put_byte(dest, n, &len, XFRM_END);
+            return len;
+        }
+
+        if (!nat_isdigit(c)) {
+            put_byte(dest, n, &len, (unsigned char) (c ^ 0x80));
+            src++;
+            continue;
+        }
+
+        size_t run = 0;
+        while (nat_isdigit(src[run]))
+            run++;
+        if (c == '0') {
+            for (size_t i = 0; i < run; i++)
+                put_byte(dest, n, &len, (unsigned char) (src[i] ^ 0x80));
+            put_byte(dest, n, &len, XFRM_RUN_END);
+        } else {
+            put_byte(dest, n, &len, XFRM_NUMBER);
+            put_length(dest, n, &len, run);
+            for (size_t i = 0; i < run; i++)
+                put_byte(dest, n, &len, (unsigned char) (src[i] ^ 0x80));
+        }
+        src += run;
+    }
+}
+
+
 /* Compare, recognizing numeric string and ignoring case. */
-// int strnatcasecmp(nat_char const *a, nat_char const *b)
-// {
-//     return strnatcmp0(a, b, 1);
-// }
+int strnatcasecmp(nat_char const *a, nat_char const *b)
+{
+    return strnatcmp0(a, b, 1);
+}
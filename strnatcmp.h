@@ -20,6 +20,7 @@
   3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <stddef.h>
 
 /* CUSTOMIZATION SECTION
  *
@@ -28,4 +29,5 @@
 typedef char nat_char;
 
 int strnatcmp(nat_char const *a, nat_char const *b);
-// int strnatcasecmp(nat_char const *a, nat_char const *b);
+size_t strnatxfrm(unsigned char *dest, nat_char const *src, size_t n);
+int strnatcasecmp(nat_char const *a, nat_char const *b);
@@ -0,0 +1,17 @@
+# Compare plain, pooled and arena element allocation
+option fail 0
+option malloc 0
+option pool 0
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+time free
+option pool 1
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+time free
+new arena
+time ih dolphin 1000000
+time it gerbil 1000000
+time free
@@ -0,0 +1,40 @@
+# Compare traversal and sort throughput of the list, unrolled and ring
+# backends on the workloads of trace-13 to trace-16
+option fail 0
+option malloc 0
+new
+time ih dolphin 1000000
+time it gerbil 1000
+time reverse
+time it jaguar 1000
+free
+new
+time ih RAND 100000
+time sort
+time reverse
+time sort
+time free
+new unrolled
+time ih dolphin 1000000
+time it gerbil 1000
+time reverse
+time it jaguar 1000
+free
+new unrolled
+time ih RAND 100000
+time sort
+time reverse
+time sort
+time free
+new ring
+time ih dolphin 1000000
+time it gerbil 1000
+time reverse
+time it jaguar 1000
+free
+new ring
+time ih RAND 100000
+time sort
+time reverse
+time sort
+time free
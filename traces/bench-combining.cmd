@@ -0,0 +1,20 @@
+# Throughput of 2 up to 32 producer and consumer threads contending for
+# one queue, shared through flat combining or behind a single lock.
+# Each run also checks that every string inserted was removed exactly once.
+option fail 0
+option malloc 0
+# Flat combining
+new combining
+stress 1 1 200000
+stress 2 2 100000
+stress 4 4 50000
+stress 8 8 25000
+stress 16 16 12500
+# Plain queue behind a single lock
+new plain
+stress 1 1 200000
+stress 2 2 100000
+stress 4 4 50000
+stress 8 8 25000
+stress 16 16 12500
+free
@@ -0,0 +1,20 @@
+# Compare the singly linked list with the doubly linked deque on removal
+# from the tail and on reverse, both of which the deque does in constant
+# time.  Strings go in at the tail, so that the harness finds the blocks
+# freed by rt among the most recent ones.
+option fail 0
+option malloc 0
+new
+time it dolphin 1000000
+time rt
+time rt
+time reverse
+time reverse
+free
+new deque
+time it dolphin 1000000
+time rt
+time rt
+time reverse
+time reverse
+free
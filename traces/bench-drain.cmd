@@ -0,0 +1,19 @@
+# Time bulk draining of a million-element queue on each queue variant
+option fail 0
+option malloc 0
+new
+ih dolphin 1000000
+time rhn 1000000
+new pool
+ih dolphin 1000000
+time rhn 1000000
+new arena
+ih dolphin 1000000
+time rhn 1000000
+new unrolled
+ih dolphin 1000000
+time rhn 1000000
+new ring
+ih dolphin 1000000
+time rhn 1000000
+free
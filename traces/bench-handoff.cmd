@@ -0,0 +1,18 @@
+# One producer thread passing strings to one consumer thread, through
+# the lock-free SPSC ring and through the other queues fit for it, then
+# through a ring behind a lock.  Reports throughput, then the cycles a
+# string sent into an empty queue takes to reach the consumer.
+option fail 0
+option malloc 0
+option capacity 1024
+new spsc
+handoff 1000000
+new lockfree
+handoff 1000000
+new twolock
+handoff 1000000
+new bounded
+handoff 1000000
+new ring
+handoff 1000000
+free
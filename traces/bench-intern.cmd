@@ -0,0 +1,64 @@
+# Compare copied with interned strings on peak memory and insertion time.
+# The strings of trace-15-perf fit inside the list elements already, so
+# interning leaves that workload as it is.  Keys too long for that, few
+# of them and repeated many times, each get a block per element when
+# copied but a single shared one when interned.  Each mem reports the
+# peak of the queue freed just before.
+option fail 0
+option malloc 0
+# Warm up the allocator, so that the first timed queue does not pay for
+# fresh pages alone
+new
+it gerbil 2000000
+free
+mem
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+reverse
+sort
+free
+mem
+option intern 1
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+reverse
+sort
+free
+mem
+option intern 0
+new
+time it customer-account-0001:order-history 250000
+time it customer-account-0002:order-history 250000
+time it customer-account-0003:order-history 250000
+time it customer-account-0004:order-history 250000
+sort
+time free
+mem
+option intern 1
+new
+time it customer-account-0001:order-history 250000
+time it customer-account-0002:order-history 250000
+time it customer-account-0003:order-history 250000
+time it customer-account-0004:order-history 250000
+sort
+time free
+mem
+option intern 0
+option pool 1
+new
+time it customer-account-0001:order-history 250000
+time it customer-account-0002:order-history 250000
+time it customer-account-0003:order-history 250000
+time it customer-account-0004:order-history 250000
+time free
+mem
+option intern 1
+new
+time it customer-account-0001:order-history 250000
+time it customer-account-0002:order-history 250000
+time it customer-account-0003:order-history 250000
+time it customer-account-0004:order-history 250000
+time free
+mem
@@ -0,0 +1,6 @@
+# Report the speedup of sorting a million random strings with 1 up to 8
+# threads, over sorting them with one
+option fail 0
+option malloc 0
+option threads 8
+sortscale 1000000
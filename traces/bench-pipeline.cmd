@@ -0,0 +1,24 @@
+# Producers and consumers passing strings through bounded queues of
+# growing capacity, waiting while the queue is full or empty.  Reports
+# throughput and percentiles of the end-to-end latency of each string,
+# from the start of its insertion to its removal.  That includes the wait
+# of the producer for room, which dominates at small capacities.
+option fail 0
+option malloc 0
+option capacity 1
+new bounded
+pipeline 1 1 100000
+pipeline 4 4 25000
+option capacity 16
+new bounded
+pipeline 1 1 100000
+pipeline 4 4 25000
+option capacity 256
+new bounded
+pipeline 1 1 100000
+pipeline 4 4 25000
+option capacity 4096
+new bounded
+pipeline 1 1 100000
+pipeline 4 4 25000
+free
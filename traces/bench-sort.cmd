@@ -0,0 +1,69 @@
+# Time sorting a million-element list queue on random, sorted and
+# reversed input, with each sort mode.  Radix sorts in byte order, which
+# agrees with natural order on the lowercase strings used here.  A sort
+# of this size takes longer than the default time limit of a second
+option time 10
+option fail 0
+option malloc 0
+# Merge and gather sorts on a list small enough to stay in cache, where
+# gathering its elements into an array gains less.  These go first: once
+# millions of blocks have been freed, the allocator takes a while to
+# merge them back together before it hands gather its array
+new
+ih RAND 50000
+time sort
+free
+new
+ih RAND 50000
+time sort gather
+free
+# Freeing a sorted list hands its blocks back in scattered order, so the
+# elements of every list after the first would be spread over the heap.
+# Sort and free one list untimed, so that every mode below starts alike
+new
+ih RAND 1000000
+sort
+free
+# Merge sort, on random input, then the sorted result, the same reversed,
+# and with equal strings added at both ends.  All but the first are a
+# few runs, which the natural merge sort takes in one scan
+new
+ih RAND 1000000
+time sort
+time sort
+reverse
+time sort
+it dolphin 500000
+ih gerbil 500000
+time sort
+free
+new
+ih RAND 1000000
+time sort key
+time sort key
+reverse
+time sort key
+it dolphin 500000
+ih gerbil 500000
+time sort key
+free
+new
+ih RAND 1000000
+time sort radix
+time sort radix
+reverse
+time sort radix
+it dolphin 500000
+ih gerbil 500000
+time sort radix
+free
+new
+ih RAND 1000000
+time sort gather
+time sort gather
+reverse
+time sort gather
+it dolphin 500000
+ih gerbil 500000
+time sort gather
+free
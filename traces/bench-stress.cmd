@@ -0,0 +1,30 @@
+# Throughput of 2 up to 16 producer and consumer threads sharing a queue.
+# Each run also checks that every string inserted was removed exactly once.
+option fail 0
+option malloc 0
+# Lock-free
+new lockfree
+stress 1 1 200000
+stress 2 2 100000
+stress 4 4 50000
+stress 8 8 25000
+# Separate head and tail locks
+new twolock
+stress 1 1 200000
+stress 2 2 100000
+stress 4 4 50000
+stress 8 8 25000
+# The same queue behind a single lock
+option lock 1
+stress 1 1 200000
+stress 2 2 100000
+stress 4 4 50000
+stress 8 8 25000
+option lock 0
+# Plain queue behind a single lock
+new plain
+stress 1 1 200000
+stress 2 2 100000
+stress 4 4 50000
+stress 8 8 25000
+free
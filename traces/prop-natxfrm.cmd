@@ -0,0 +1,5 @@
+# Check that strnatxfrm transforms order random strings, and prefixes of
+# them, as strnatcmp does
+option fail 0
+option malloc 0
+natcheck 1000000
@@ -0,0 +1,38 @@
+# Test of sort in each built-in order, on strings that the orders disagree on
+option fail 0
+option malloc 0
+new
+it file10
+it File9
+it file9
+it FILE010
+it a
+it bb
+it B
+it ccc
+it x2y
+it x10y
+it RAND 200
+sort bytes
+sort bytes-desc
+sort nocase
+sort nocase-desc
+sort natural
+sort natural-desc
+sort natural-nocase
+sort natural-nocase-desc
+sort length
+sort length-desc
+sort
+sort radix
+free
+new ring
+it file10
+it File9
+it FILE010
+it x2y
+it x10y
+sort natural-nocase
+sort length-desc
+sort bytes
+free
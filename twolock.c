@@ -0,0 +1,168 @@
+/*
+ * Two-lock backend for Q_TWOLOCK queues.
+ *
+ * Michael and Scott's two-lock queue: a chain of nodes behind a sentinel,
+ * with one lock for the head and another for the tail.  Producers only
+ * take the tail lock and consumers only the head lock, so insertions at
+ * the tail never wait for removals at the head, nor the other way round.
+ * The two sides only meet at the link of the last node, which is
+ * published with release and read with acquire ordering.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+typedef struct {
+    pthread_mutex_t head_lock;
+    cnode_t *head; /* Sentinel */
+    char pad[CACHE_LINE];
+    pthread_mutex_t tail_lock;
+    cnode_t *tail; /* Last node */
+} tlqueue_t;
+
+static bool tl_init(queue_t *q)
+{
+    tlqueue_t *tl = malloc(sizeof(tlqueue_t));
+    if (tl == NULL)
+        return false;
+    tl->head = malloc(sizeof(cnode_t));
+    if (tl->head == NULL) {
+        free(tl);
+        return false;
+    }
+    tl->head->next = NULL;
+    tl->head->value = NULL;
+    tl->tail = tl->head;
+    pthread_mutex_init(&tl->head_lock, NULL);
+    pthread_mutex_init(&tl->tail_lock, NULL);
+    q->impl = tl;
+    return true;
+}
+
+static void tl_destroy(queue_t *q)
+{
+    tlqueue_t *tl = q->impl;
+    chain_free(tl->head);
+    pthread_mutex_destroy(&tl->head_lock);
+    pthread_mutex_destroy(&tl->tail_lock);
+    free(tl);
+}
+
+static bool tl_insert_tail(queue_t *q, char *s)
+{
+    tlqueue_t *tl = q->impl;
+    cnode_t *n = chain_node(s);
+    if (n == NULL)
+        return false;
+    pthread_mutex_lock(&tl->tail_lock);
+    /* Counted before it can be removed, so the size never underflows */
+    __atomic_fetch_add(&q->size, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&tl->tail->next, n, __ATOMIC_RELEASE);
+    tl->tail = n;
+    pthread_mutex_unlock(&tl->tail_lock);
+    return true;
+}
+
+static char *tl_take_head(queue_t *q)
+{
+    tlqueue_t *tl = q->impl;
+    pthread_mutex_lock(&tl->head_lock);
+    cnode_t *head = tl->head;
+    cnode_t *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        pthread_mutex_unlock(&tl->head_lock);
+        return NULL;
+    }
+    /* The first node becomes the sentinel, its string is ours */
+    char *s = next->value;
+    tl->head = next;
+    pthread_mutex_unlock(&tl->head_lock);
+    __atomic_fetch_sub(&q->size, 1, __ATOMIC_RELAXED);
+    free(head);
+    return s;
+}
+
+static bool tl_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    char *s = tl_take_head(q);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+/* The remaining operations need the queue to themselves */
+
+static bool tl_insert_head(queue_t *q, char *s)
+{
+    tlqueue_t *tl = q->impl;
+    if (!chain_push(&tl->head, s))
+        return false;
+    q->size += 1;
+    return true;
+}
+
+static bool tl_concat(queue_t *dst, queue_t *src)
+{
+    tlqueue_t *d = dst->impl, *s = src->impl;
+    chain_move(s->head, &s->tail, s->tail, &d->tail);
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+static bool tl_split(queue_t *q, int k, queue_t *out)
+{
+    tlqueue_t *tl = q->impl, *o = out->impl;
+    chain_move(tl->head, &tl->tail, chain_at(tl->head, k), &o->tail);
+    q->size -= k;
+    out->size += k;
+    return true;
+}
+
+static void tl_reverse(queue_t *q)
+{
+    tlqueue_t *tl = q->impl;
+    tl->tail = chain_reverse(tl->head);
+}
+
+static void tl_sort(queue_t *q, q_cmp_t cmp)
+{
+    tlqueue_t *tl = q->impl;
+    tl->tail = chain_sort(tl->head, cmp);
+}
+
+static void tl_iter_init(queue_t *q, q_iter_t *it)
+{
+    tlqueue_t *tl = q->impl;
+    it->node = tl->head->next;
+    it->idx = 0;
+}
+
+static char *tl_iter_next(queue_t *q, q_iter_t *it)
+{
+    return chain_iter_next(it);
+}
+
+const struct BACKEND twolock_backend = {
+    .thread_safe = true,
+    .spsc_safe = true,
+    .init = tl_init,
+    .destroy = tl_destroy,
+    .insert_head = tl_insert_head,
+    .insert_tail = tl_insert_tail,
+    .remove_head = tl_remove_head,
+    .take_head = tl_take_head,
+    .concat = tl_concat,
+    .split = tl_split,
+    .reverse = tl_reverse,
+    .sort = tl_sort,
+    .iter_init = tl_iter_init,
+    .iter_next = tl_iter_next,
+};
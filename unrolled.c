@@ -0,0 +1,460 @@
+/*
+ * Unrolled linked list backend for Q_UNROLLED queues.
+ *
+ * Instead of one list element per string, nodes the size of two cache
+ * lines hold up to UNROLLED_SLOTS string pointers each.  Walking the
+ * queue then costs one cache miss per node rather than one per string.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "harness.h"
+
+/* Number of string pointers per node, filling two 64-byte cache lines */
+#define UNROLLED_SLOTS 14
+
+/*
+ * Node of the unrolled list.
+ * Occupied slots are [begin, end).  The head node grows towards the
+ * front and the tail node towards the back, so that both q_insert_head
+ * and q_insert_tail are O(1).
+ */
+typedef struct UNODE {
+    struct UNODE *next;
+    unsigned short begin;
+    unsigned short end;
+    char *slot[UNROLLED_SLOTS];
+} unode_t;
+
+/*
+ * Sorting merges runs of nodes into nodes emptied along the way, which
+ * takes up to two nodes of slack.  At least that many empty nodes are
+ * kept spare at all times, so that sorting never has to allocate.
+ */
+#define UNROLLED_MIN_SPARES 2
+
+typedef struct {
+    unode_t *head;
+    unode_t *tail;
+    unode_t *spare; /* Empty nodes, linked through next */
+    unsigned int spare_count;
+} unrolled_t;
+
+static inline void spare_push(unrolled_t *u, unode_t *n)
+{
+    n->next = u->spare;
+    u->spare = n;
+    u->spare_count += 1;
+}
+
+static inline unode_t *spare_pop(unrolled_t *u)
+{
+    unode_t *n = u->spare;
+    u->spare = n->next;
+    u->spare_count -= 1;
+    return n;
+}
+
+/* Get an empty node, return NULL if could not allocate space */
+static unode_t *node_get(unrolled_t *u)
+{
+    if (u->spare_count > UNROLLED_MIN_SPARES)
+        return spare_pop(u);
+    return malloc(sizeof(unode_t));
+}
+
+/* Give back a node that has become empty */
+static void node_put(unrolled_t *u, unode_t *n)
+{
+    if (u->spare_count < UNROLLED_MIN_SPARES)
+        spare_push(u, n);
+    else
+        free(n);
+}
+
+static void free_nodes(unode_t *n)
+{
+    while (n != NULL) {
+        unode_t *next = n->next;
+        free(n);
+        n = next;
+    }
+}
+
+static bool unrolled_init(queue_t *q)
+{
+    unrolled_t *u = malloc(sizeof(unrolled_t));
+    if (u == NULL)
+        return false;
+    memset(u, 0, sizeof(unrolled_t));
+    for (int i = 0; i < UNROLLED_MIN_SPARES; i++) {
+        unode_t *n = malloc(sizeof(unode_t));
+        if (n == NULL) {
+            free_nodes(u->spare);
+            free(u);
+            return false;
+        }
+        spare_push(u, n);
+    }
+    q->impl = u;
+    return true;
+}
+
+static void unrolled_destroy(queue_t *q)
+{
+    unrolled_t *u = q->impl;
+    for (unode_t *n = u->head; n != NULL; n = n->next) {
+        for (unsigned int i = n->begin; i < n->end; i++)
+            free(n->slot[i]);
+    }
+    free_nodes(u->head);
+    free_nodes(u->spare);
+    free(u);
+}
+
+static bool unrolled_insert_head(queue_t *q, char *s)
+{
+    unrolled_t *u = q->impl;
+    char *copy = strdup(s);
+    if (copy == NULL)
+        return false;
+    unode_t *h = u->head;
+    if (h == NULL || h->begin == 0) {
+        unode_t *n = node_get(u);
+        if (n == NULL) {
+            free(copy);
+            return false;
+        }
+        n->begin = UNROLLED_SLOTS;
+        n->end = UNROLLED_SLOTS;
+        n->next = h;
+        if (h == NULL)
+            u->tail = n;
+        u->head = n;
+        h = n;
+    }
+    h->slot[--h->begin] = copy;
+    q->size += 1;
+    return true;
+}
+
+static bool unrolled_insert_tail(queue_t *q, char *s)
+{
+    unrolled_t *u = q->impl;
+    char *copy = strdup(s);
+    if (copy == NULL)
+        return false;
+    unode_t *t = u->tail;
+    if (t == NULL || t->end == UNROLLED_SLOTS) {
+        unode_t *n = node_get(u);
+        if (n == NULL) {
+            free(copy);
+            return false;
+        }
+        n->begin = 0;
+        n->end = 0;
+        n->next = NULL;
+        if (t == NULL)
+            u->head = n;
+        else
+            t->next = n;
+        u->tail = n;
+        t = n;
+    }
+    t->slot[t->end++] = copy;
+    q->size += 1;
+    return true;
+}
+
+static char *unrolled_take_head(queue_t *q)
+{
+    unrolled_t *u = q->impl;
+    unode_t *h = u->head;
+    if (h == NULL)
+        return NULL;
+    char *s = h->slot[h->begin++];
+    q->size -= 1;
+    if (h->begin == h->end) {
+        u->head = h->next;
+        if (u->head == NULL)
+            u->tail = NULL;
+        node_put(u, h);
+    }
+    return s;
+}
+
+static bool unrolled_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    char *s = unrolled_take_head(q);
+    if (s == NULL)
+        return false;
+    if (sp != NULL)
+        copy_removed(sp, bufsize, s, strlen(s));
+    free(s);
+    return true;
+}
+
+static bool unrolled_concat(queue_t *dst, queue_t *src)
+{
+    unrolled_t *d = dst->impl, *s = src->impl;
+    if (s->head == NULL)
+        return true;
+    // Partly filled nodes may now sit in the middle of the chain, which
+    // is fine for every operation but wastes some slots until a sort
+    if (d->head == NULL)
+        d->head = s->head;
+    else
+        d->tail->next = s->head;
+    d->tail = s->tail;
+    s->head = NULL;
+    s->tail = NULL;
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+static bool unrolled_split(queue_t *q, int k, queue_t *out)
+{
+    unrolled_t *u = q->impl, *o = out->impl;
+    if (k == 0)
+        return true;
+    // Find the node holding the first string to stay in q
+    unode_t *prev = NULL, *n = u->head;
+    unsigned int left = k;
+    while (left > 0 && left >= (unsigned int) (n->end - n->begin)) {
+        left -= n->end - n->begin;
+        prev = n;
+        n = n->next;
+    }
+    unode_t *first = u->head, *last = prev;
+    if (left > 0) {
+        // The cut falls inside node n, move its first strings to a new node
+        unode_t *m = node_get(o);
+        if (m == NULL)
+            return false;
+        memcpy(m->slot, n->slot + n->begin, sizeof(char *) * left);
+        m->begin = 0;
+        m->end = left;
+        n->begin += left;
+        if (prev == NULL)
+            first = m;
+        else
+            prev->next = m;
+        last = m;
+    }
+    last->next = NULL;
+    u->head = n;
+    if (n == NULL)
+        u->tail = NULL;
+    if (o->head == NULL)
+        o->head = first;
+    else
+        o->tail->next = first;
+    o->tail = last;
+    q->size -= k;
+    out->size += k;
+    return true;
+}
+
+static void unrolled_reverse(queue_t *q)
+{
+    unrolled_t *u = q->impl;
+    unode_t *prev = NULL;
+    unode_t *n = u->head;
+    while (n != NULL) {
+        // Reverse the strings within the node, then the node links
+        for (int i = n->begin, j = n->end - 1; i < j; i++, j--) {
+            char *tmp = n->slot[i];
+            n->slot[i] = n->slot[j];
+            n->slot[j] = tmp;
+        }
+        unode_t *next = n->next;
+        n->next = prev;
+        prev = n;
+        n = next;
+    }
+    u->tail = u->head;
+    u->head = prev;
+}
+
+/*
+ * Move all strings to the front of the node chain, so that every node
+ * but the last one is full and starts at slot 0.  Nodes left empty go to
+ * the spare list.  Return the number of nodes still in use.
+ */
+static unsigned int unrolled_pack(unrolled_t *u)
+{
+    unode_t *w = u->head;
+    unsigned int wi = 0, nodes = 1;
+    for (unode_t *r = u->head; r != NULL; r = r->next) {
+        // The writer never passes the reader, so no string is overwritten
+        for (unsigned int i = r->begin; i < r->end; i++) {
+            if (wi == UNROLLED_SLOTS) {
+                w->begin = 0;
+                w->end = UNROLLED_SLOTS;
+                w = w->next;
+                wi = 0;
+                nodes++;
+            }
+            w->slot[wi++] = r->slot[i];
+        }
+    }
+    w->begin = 0;
+    w->end = wi;
+    unode_t *rest = w->next;
+    while (rest != NULL) {
+        unode_t *next = rest->next;
+        spare_push(u, rest);
+        rest = next;
+    }
+    w->next = NULL;
+    u->tail = w;
+    return nodes;
+}
+
+/* Insertion sort of the strings within one node */
+static void node_sort(unode_t *n, q_cmp_t cmp)
+{
+    for (unsigned int i = n->begin + 1; i < n->end; i++) {
+        char *s = n->slot[i];
+        unsigned int j = i;
+        while (j > n->begin && cmp(n->slot[j - 1], s) > 0) {
+            n->slot[j] = n->slot[j - 1];
+            j--;
+        }
+        n->slot[j] = s;
+    }
+}
+
+/* Detach the first count nodes of chain *rest, return them */
+static unode_t *take_nodes(unode_t **rest, unsigned int count)
+{
+    unode_t *first = *rest;
+    unode_t *last = first;
+    for (unsigned int i = 1; last != NULL && i < count; i++)
+        last = last->next;
+    if (last == NULL) {
+        *rest = NULL;
+    } else {
+        *rest = last->next;
+        last->next = NULL;
+    }
+    return first;
+}
+
+/*
+ * Merge sorted node chains a and b onto the chain ending at *out_tail.
+ * Output goes to spare nodes, and every input node is returned to the
+ * spare list as soon as its last string has been taken.
+ */
+static void merge_nodes(unrolled_t *u,
+                        unode_t *a,
+                        unode_t *b,
+                        unode_t **out_tail,
+                        q_cmp_t cmp)
+{
+    unsigned int ai = a->begin, bi = b->begin;
+    unode_t *o = *out_tail;
+    while (a != NULL || b != NULL) {
+        unode_t **from;
+        unsigned int *fi;
+        if (b == NULL ||
+            (a != NULL && cmp(a->slot[ai], b->slot[bi]) <= 0)) {
+            from = &a;
+            fi = &ai;
+        } else {
+            from = &b;
+            fi = &bi;
+        }
+        if (o->end == UNROLLED_SLOTS) {
+            unode_t *n = spare_pop(u);
+            n->begin = 0;
+            n->end = 0;
+            n->next = NULL;
+            o->next = n;
+            o = n;
+        }
+        o->slot[o->end++] = (*from)->slot[(*fi)++];
+        if (*fi == (*from)->end) {
+            unode_t *done = *from;
+            *from = done->next;
+            *fi = *from != NULL ? (*from)->begin : 0;
+            spare_push(u, done);
+        }
+    }
+    *out_tail = o;
+}
+
+/*
+ * Bottom-up merge sort over whole nodes.
+ * After packing, every node but the last is full, so runs of 1, 2, 4 ...
+ * nodes can be merged pairwise while staying aligned to node boundaries.
+ */
+static void unrolled_sort(queue_t *q, q_cmp_t cmp)
+{
+    unrolled_t *u = q->impl;
+    if (q->size < 2)
+        return;
+    unsigned int nodes = unrolled_pack(u);
+    for (unode_t *n = u->head; n != NULL; n = n->next)
+        node_sort(n, cmp);
+
+    for (unsigned int width = 1; width < nodes; width *= 2) {
+        // Start the output with a sentinel node that is already full, so
+        // merge_nodes() fetches a real node before writing anything
+        unode_t pseudo = {.next = NULL, .begin = 0, .end = UNROLLED_SLOTS};
+        unode_t *out_tail = &pseudo;
+        unode_t *rest = u->head;
+        while (rest != NULL) {
+            unode_t *a = take_nodes(&rest, width);
+            unode_t *b = take_nodes(&rest, width);
+            if (b == NULL) {
+                out_tail->next = a;
+                while (out_tail->next != NULL)
+                    out_tail = out_tail->next;
+                break;
+            }
+            merge_nodes(u, a, b, &out_tail, cmp);
+        }
+        u->head = pseudo.next;
+        u->tail = out_tail;
+    }
+}
+
+static void unrolled_iter_init(queue_t *q, q_iter_t *it)
+{
+    unrolled_t *u = q->impl;
+    it->node = u->head;
+    it->idx = u->head != NULL ? u->head->begin : 0;
+}
+
+static char *unrolled_iter_next(queue_t *q, q_iter_t *it)
+{
+    unode_t *n = it->node;
+    while (n != NULL && it->idx == n->end) {
+        n = n->next;
+        it->node = n;
+        it->idx = n != NULL ? n->begin : 0;
+    }
+    if (n == NULL)
+        return NULL;
+    return n->slot[it->idx++];
+}
+
+const struct BACKEND unrolled_backend = {
+    .thread_safe = false,
+    .init = unrolled_init,
+    .destroy = unrolled_destroy,
+    .insert_head = unrolled_insert_head,
+    .insert_tail = unrolled_insert_tail,
+    .remove_head = unrolled_remove_head,
+    .take_head = unrolled_take_head,
+    .concat = unrolled_concat,
+    .split = unrolled_split,
+    .reverse = unrolled_reverse,
+    .sort = unrolled_sort,
+    .iter_init = unrolled_iter_init,
+    .iter_next = unrolled_iter_next,
+};